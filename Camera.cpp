@@ -1,5 +1,8 @@
+#include <cmath>
+
 #include <QMatrix4x4>
 #include <QVector3D>
+#include <QtMath>
 
 #include "Camera.h"
 
@@ -22,3 +25,10 @@ void Camera::rotate(const QQuaternion& q) {
 void Camera::zoom(float factor) {
     _eye -= _eye.normalized() * factor;
 }
+
+void Camera::frame(const QVector3D& center, float radius, float fieldOfView) {
+    QVector3D direction = (_eye - _target).normalized();
+    float distance = radius / std::sin(qDegreesToRadians(fieldOfView) / 2);
+    _target = center;
+    _eye = center + direction * distance;
+}
@@ -20,6 +20,8 @@ public:
 
     void rotate(const QQuaternion& q);
     void zoom(float factor);
+    // keeps the view direction and moves so a sphere fills the vertical field of view
+    void frame(const QVector3D& center, float radius, float fieldOfView);
 
 
 private:
@@ -0,0 +1,56 @@
+#include <QOpenGLFunctions_3_3_Core>
+#include <QElapsedTimer>
+
+#include "FrameProfiler.h"
+
+void FrameProfiler::initialize() {
+    initializeOpenGLFunctions();
+    glGenQueries(queryCount, _queries);
+}
+
+void FrameProfiler::destroy() {
+    if (_queries[0] != 0) {
+        glDeleteQueries(queryCount, _queries);
+        for (int i = 0; i < queryCount; ++i)
+            _queries[i] = 0;
+    }
+    for (int i = 0; i < queryCount; ++i)
+        _pending[i] = false;
+    _next = 0;
+    _active = -1;
+}
+
+void FrameProfiler::beginFrame() {
+    // oldest first, so the newest available result is the one kept
+    for (int k = 0; k < queryCount; ++k) {
+        int i = (_next + k) % queryCount;
+        if (!_pending[i])
+            continue;
+        GLint available = 0;
+        glGetQueryObjectiv(_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(_queries[i], GL_QUERY_RESULT, &nanoseconds);
+        _gpuMilliseconds = nanoseconds / 1e6;
+        _pending[i] = false;
+    }
+    _stats = RenderStats();
+    _timer.start();
+    _active = -1;
+    if (_queries[_next] != 0 && !_pending[_next]) {
+        _active = _next;
+        _next = (_next + 1) % queryCount;
+        glBeginQuery(GL_TIME_ELAPSED, _queries[_active]);
+    }
+}
+
+void FrameProfiler::endFrame() {
+    if (_active >= 0) {
+        glEndQuery(GL_TIME_ELAPSED);
+        _pending[_active] = true;
+        _active = -1;
+    }
+    _cpuMilliseconds = _timer.nsecsElapsed() / 1e6;
+    _lastStats = _stats;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QElapsedTimer>
+
+#include "RenderStats.h"
+
+// Measures CPU and GPU time of a frame. GPU time comes from a small ring of
+// timer queries that are only read once GL reports their result available,
+// so the GPU figure lags a frame or two behind but reading it never waits.
+// A frame finding every query still in flight goes untimed.
+class FrameProfiler : protected QOpenGLFunctions_3_3_Core {
+public:
+    void initialize();
+    void destroy();
+    void beginFrame();
+    void endFrame();
+
+    RenderStats& getStats() { return _stats; }
+    const RenderStats& getLastStats() const { return _lastStats; }
+    double getCpuMilliseconds() const { return _cpuMilliseconds; }
+    double getGpuMilliseconds() const { return _gpuMilliseconds; }
+
+private:
+    static constexpr int queryCount = 3;
+
+    GLuint _queries[queryCount] = {};
+    bool _pending[queryCount] = {};
+    // query the next frame starts, and the one of the running frame or -1
+    int _next = 0;
+    int _active = -1;
+    QElapsedTimer _timer;
+    double _cpuMilliseconds = 0;
+    double _gpuMilliseconds = 0;
+    RenderStats _stats;
+    RenderStats _lastStats;
+};
@@ -0,0 +1,46 @@
+#include <array>
+
+#include <QMatrix4x4>
+#include <QVector4D>
+
+#include "Frustum.h"
+
+Frustum::Frustum(const QMatrix4x4& viewProjection) {
+    QVector4D x = viewProjection.row(0);
+    QVector4D y = viewProjection.row(1);
+    QVector4D z = viewProjection.row(2);
+    QVector4D w = viewProjection.row(3);
+    _planes = {w + x, w - x, w + y, w - y, w + z, w - z};
+}
+
+bool Frustum::intersects(const geometry::BoundingBox<float>& box) const {
+    if (box.isEmpty()) return false;
+    for (const auto& plane : _planes) {
+        // corner furthest along the plane normal
+        float x = plane.x() >= 0 ? box.max.x : box.min.x;
+        float y = plane.y() >= 0 ? box.max.y : box.min.y;
+        float z = plane.z() >= 0 ? box.max.z : box.min.z;
+        if (plane.x() * x + plane.y() * y + plane.z() * z + plane.w() < 0)
+            return false;
+    }
+    return true;
+}
+
+bool Frustum::intersects(const geometry::BoundingBox<float>& box, const QMatrix4x4& model) const {
+    if (model.isIdentity())
+        return intersects(box);
+    return intersects(transformBox(box, model));
+}
+
+geometry::BoundingBox<float> transformBox(const geometry::BoundingBox<float>& box, const QMatrix4x4& matrix) {
+    geometry::BoundingBox<float> result;
+    if (box.isEmpty()) return result;
+    for (int corner = 0; corner < 8; ++corner) {
+        QVector3D v(corner & 1 ? box.max.x : box.min.x,
+                    corner & 2 ? box.max.y : box.min.y,
+                    corner & 4 ? box.max.z : box.min.z);
+        QVector3D mapped = matrix.map(v);
+        result.extend({mapped.x(), mapped.y(), mapped.z()});
+    }
+    return result;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <array>
+
+#include <QMatrix4x4>
+#include <QVector4D>
+
+#include "Geometry.h"
+
+// Six clip planes extracted from a view-projection matrix, normals point inside.
+class Frustum {
+public:
+    Frustum(const QMatrix4x4& viewProjection);
+
+    // conservative, a box straddling a corner of the frustum may pass
+    bool intersects(const geometry::BoundingBox<float>& box) const;
+    bool intersects(const geometry::BoundingBox<float>& box, const QMatrix4x4& model) const;
+
+private:
+    std::array<QVector4D, 6> _planes;
+};
+
+geometry::BoundingBox<float> transformBox(const geometry::BoundingBox<float>& box, const QMatrix4x4& matrix);
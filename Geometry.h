@@ -4,6 +4,8 @@
 #include <numeric>
 #include <functional> 
 #include <cmath>
+#include <limits>
+#include <algorithm>
 
 namespace geometry {
     
@@ -170,6 +172,29 @@ return getRadius(getCentroid(vertices), vertices);
 }
 
 
+template<typename T>
+struct BoundingBox {
+    Vec3<T> min = {std::numeric_limits<T>::max(), std::numeric_limits<T>::max(), std::numeric_limits<T>::max()};
+    Vec3<T> max = {std::numeric_limits<T>::lowest(), std::numeric_limits<T>::lowest(), std::numeric_limits<T>::lowest()};
+
+    bool isEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    Vec3<T> center() const { return (min + max) / static_cast<T>(2); }
+    Vec3<T> size() const { return max - min; }
+
+    void extend(const Vec3<T>& v) {
+        min = {std::min(min.x, v.x), std::min(min.y, v.y), std::min(min.z, v.z)};
+        max = {std::max(max.x, v.x), std::max(max.y, v.y), std::max(max.z, v.z)};
+    }
+    void extend(const BoundingBox& box) {
+        if(box.isEmpty()) return;
+        extend(box.min);
+        extend(box.max);
+    }
+    bool contains(const Vec3<T>& v) const {
+        return v.x >= min.x && v.x <= max.x && v.y >= min.y && v.y <= max.y && v.z >= min.z && v.z <= max.z;
+    }
+};
+
 template<typename T>
 Vec3< T > sumVectors(const std::vector< Vec3< T > >& vertices){
     return std::accumulate(vertices.begin(), vertices.end()
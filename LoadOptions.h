@@ -0,0 +1,9 @@
+#pragma once
+
+// post processing shared by the scene file loaders
+struct LoadOptions {
+    // merges vertices closer than weldTolerance times the model's bounding box
+    // diagonal, for files that repeat the vertices of every face
+    bool weld = false;
+    float weldTolerance = 1e-6f;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#include <QVector3D>
+
+#include "Geometry.h"
+
+// Picks the coarsest level of detail whose error, projected to the screen from
+// the closest point of the bounds, stays under maxPixelError.
+struct LodSelector {
+    QVector3D eye;
+    // pixels covered by one unit at distance one, viewport height / (2 tan(fov / 2))
+    float pixelsPerUnit = 0;
+    float maxPixelError = 1.0f;
+
+    // levels are ordered from fine to coarse and expose an error in model units,
+    // returns 0 for the full mesh and i for levels[i - 1]
+    template <typename Levels>
+    size_t select(const Levels& levels, const geometry::BoundingBox<float>& worldBounds, float scale = 1.0f) const {
+        float dx = std::max({worldBounds.min.x - eye.x(), 0.0f, eye.x() - worldBounds.max.x});
+        float dy = std::max({worldBounds.min.y - eye.y(), 0.0f, eye.y() - worldBounds.max.y});
+        float dz = std::max({worldBounds.min.z - eye.z(), 0.0f, eye.z() - worldBounds.max.z});
+        float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+        if (distance <= 0)
+            return 0;
+        size_t chosen = 0;
+        for (size_t i = 0; i < levels.size(); ++i) {
+            if (levels[i].error * scale * pixelsPerUnit / distance > maxPixelError)
+                break;
+            chosen = i + 1;
+        }
+        return chosen;
+    }
+};
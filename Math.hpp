@@ -1,3 +1,4 @@
+#pragma once
 #include "Geometry.h"
 
 namespace math{
@@ -25,7 +26,7 @@ namespace math{
                xVec.x*zVec.y*yVec.z;               
     }
 
-    int signum(float a){
+    inline int signum(float a){
         return a > 0? 1 : a == 0? 0 : -1;
     }
     template<typename T>
@@ -1,7 +1,11 @@
+#pragma once
+#include <unordered_map>
+#include <cstdint>
 #include "Model.h"
 
 class IcoSphere {
-using Lookup=std::map<std::pair<unsigned int, unsigned int>, unsigned int>;
+// edge (smaller index << 32 | larger index) to its midpoint vertex
+using Lookup=std::unordered_map<uint64_t, unsigned int>;
 
 static constexpr const float X=.525731112119133606f;
 static constexpr const float Z=.850650808352039932f;
@@ -28,11 +32,11 @@ unsigned int vertex_for_edge(Lookup& lookup,
 {
     using std::swap;
 
-    Lookup::key_type key(first, second);
-    if (key.first>key.second)
-        swap(key.first, key.second);
+    if (first>second)
+        swap(first, second);
+    Lookup::key_type key=(static_cast<uint64_t>(first) << 32) | second;
  
-    auto inserted=lookup.insert({key, vertices.size()});
+    auto inserted=lookup.insert({key, static_cast<unsigned int>(vertices.size())});
     if (inserted.second){
         auto& edge0=vertices[first];
         auto& edge1=vertices[second];
@@ -47,7 +51,11 @@ std::vector<geometry::Vec3<unsigned int>> subdivide(std::vector<geometry::Vec3<f
   std::vector<geometry::Vec3<unsigned int>> triangles)
 {
   Lookup lookup;
+  // every edge is shared by two triangles
+  lookup.reserve(triangles.size() * 3 / 2);
+  vertices.reserve(vertices.size() + triangles.size() * 3 / 2);
   std::vector<geometry::Vec3<unsigned int>> result;
+  result.reserve(triangles.size() * 4);
  
   for (auto&& each:triangles)
   {
@@ -76,20 +84,71 @@ Model get(QOpenGLShaderProgram& program, float radius, unsigned int subdivisions
     Model result(program);
     for(const auto & v : _vertices){
         result.addVertex(v);
+        // exact normal of the sphere, shared so the GPU mesh keeps its topology
+        result.addNormal(v);
     }
     result.uniformScale(radius);
-    unsigned index = 0;
+    // the tables wind clockwise seen from outside, emit counter-clockwise
     for(const auto & t : _triangles){
-        auto normal = geometry::getNormal(
-                                    _vertices[t.x],
-                                    _vertices[t.y],
-                                    _vertices[t.z]);
-        result.addNormal(normal);
-        result.addIndexPack({t.x, {}, index});
-        result.addIndexPack({t.y, {}, index});
-        result.addIndexPack({t.z, {}, index});
-        index++;
+        result.addIndexPack({t.x, {}, t.x});
+        result.addIndexPack({t.z, {}, t.z});
+        result.addIndexPack({t.y, {}, t.y});
     }
     return result;
 }
 };
+
+// cube with every face split into a grid, pushed out onto the sphere; quads
+// stay quad-like so it projects more evenly along the axes than IcoSphere
+class CubeSphere {
+using Lookup=std::map<std::array<unsigned int, 3>, unsigned int>;
+
+unsigned int vertex_for_point(Lookup& lookup, Model& result, unsigned int resolution,
+    const std::array<unsigned int, 3>& point)
+{
+    auto inserted=lookup.insert({point, static_cast<unsigned int>(result.getVertices().size())});
+    if (inserted.second){
+        geometry::Vec3<float> v = {2.f*point[0]/resolution - 1.f,
+                                   2.f*point[1]/resolution - 1.f,
+                                   2.f*point[2]/resolution - 1.f};
+        v = geometry::normalize(v);
+        result.addVertex(v);
+        result.addNormal(v);
+    }
+    return inserted.first->second;
+}
+
+public:
+// every face gets 2^subdivisions quads along each edge
+Model get(QOpenGLShaderProgram& program, float radius, unsigned int subdivisions){
+    unsigned int resolution = 1u << subdivisions;
+    Model result(program);
+    Lookup lookup;
+    for (unsigned int axis=0; axis < 3; ++axis){
+        unsigned int u = (axis + 1) % 3;
+        unsigned int v = (axis + 2) % 3;
+        for (unsigned int side : {0u, resolution}){
+            for (unsigned int i=0; i < resolution; ++i){
+                for (unsigned int j=0; j < resolution; ++j){
+                    std::array<unsigned int, 4> quad;
+                    const unsigned int corners[4][2] = {{i, j}, {i + 1, j}, {i + 1, j + 1}, {i, j + 1}};
+                    for (int c=0; c < 4; ++c){
+                        std::array<unsigned int, 3> point;
+                        point[axis] = side;
+                        point[u] = corners[c][0];
+                        point[v] = corners[c][1];
+                        quad[c] = vertex_for_point(lookup, result, resolution, point);
+                    }
+                    // u x v points along +axis, faces on the low side are flipped
+                    if (side == 0)
+                        std::swap(quad[1], quad[3]);
+                    for (unsigned int k : {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]})
+                        result.addIndexPack({k, {}, k});
+                }
+            }
+        }
+    }
+    result.uniformScale(radius);
+    return result;
+}
+};
@@ -1,5 +1,7 @@
 #include <vector>
 #include <memory>
+#include <cstddef>
+#include <algorithm>
 
 #include <QOpenGLFunctions>
 #include <QOpenGLBuffer>
@@ -10,10 +12,8 @@
 
 Model::Model(QOpenGLShaderProgram& program)
     : _GPUprogram(program)
-    , _GPUvertices(QOpenGLBuffer::VertexBuffer)
-    , _GPUnormals(QOpenGLBuffer::VertexBuffer)
+    , _GPUattributes(QOpenGLBuffer::VertexBuffer)
     , _GPUindices(QOpenGLBuffer::IndexBuffer){
-    initializeOpenGLFunctions();
 }
 
 Model::~Model() {
@@ -22,18 +22,22 @@ Model::~Model() {
 
 Model::Model(const Model& model)
     : _onGPU(false)
+    , _streaming(model._streaming)
     , _GPUprogram(model._GPUprogram)
-    , _GPUvertices(QOpenGLBuffer::VertexBuffer)
-    , _GPUnormals(QOpenGLBuffer::VertexBuffer)
+    , _GPUattributes(QOpenGLBuffer::VertexBuffer)
     , _GPUindices(QOpenGLBuffer::IndexBuffer)
     , _color(model._color)
+    , _transform(model._transform)
     , _name(model._name)
     , _vertices(model._vertices)
     , _normals(model._normals)
     , _textures(model._textures)
     , _indexPacks(model._indexPacks)
-    , _indices(model._indices){
-        initializeOpenGLFunctions();
+    , _indices(model._indices)
+    , _chunks(model._chunks)
+    , _bounds(model._bounds)
+    , _lods(model._lods)
+    , _lodIndices(model._lodIndices){
 }
 
 Model& Model::operator=(Model model) {
@@ -44,94 +48,296 @@ Model& Model::operator=(Model model) {
 void swap(Model& first, Model& second) {
     using std::swap;
     swap(first._onGPU, second._onGPU);
-    swap(first._GPUvertices, second._GPUvertices);
-    swap(first._GPUnormals, second._GPUnormals);
+    swap(first._geometryDirty, second._geometryDirty);
+    swap(first._streaming, second._streaming);
+    swap(first._dirtyFirst, second._dirtyFirst);
+    swap(first._dirtyLast, second._dirtyLast);
+    swap(first._GPUattributes, second._GPUattributes);
     swap(first._GPUindices, second._GPUindices);
     swap(first._color, second._color);
+    swap(first._transform, second._transform);
     swap(first._name, second._name);
     swap(first._vertices, second._vertices);
     swap(first._normals, second._normals);
     swap(first._textures, second._textures);
     swap(first._indexPacks, second._indexPacks);
     swap(first._indices, second._indices);
+    swap(first._chunks, second._chunks);
+    swap(first._vertexChunkOffsets, second._vertexChunkOffsets);
+    swap(first._vertexChunks, second._vertexChunks);
+    swap(first._bounds, second._bounds);
+    swap(first._lods, second._lods);
+    swap(first._lodIndices, second._lodIndices);
+    swap(first._indicesDirty, second._indicesDirty);
 }
 
 void Model::uniformScale(float ratio){
-    for(auto & v : _vertices){
-        v *= ratio;
-    }
-    if(_onGPU)
-        loadPosition();
+    QMatrix4x4 scale;
+    scale.scale(ratio);
+    _transform = scale * _transform;
 }
 
 void Model::translate(geometry::Vec3<float> translation){
-    for(auto & v : _vertices){
-        v += translation;
+    QMatrix4x4 shift;
+    shift.translate(translation.x, translation.y, translation.z);
+    _transform = shift * _transform;
+}
+
+static geometry::Vec3<float> mapVector(const QMatrix4x4& matrix, const geometry::Vec3<float>& v){
+    QVector3D mapped = matrix.map(QVector3D(v.x, v.y, v.z));
+    return {mapped.x(), mapped.y(), mapped.z()};
+}
+
+geometry::Vec3<float> Model::getWorldVertex(unsigned int index) const {
+    if(_transform.isIdentity())
+        return _vertices.at(index);
+    return mapVector(_transform, _vertices.at(index));
+}
+
+// the top rows of an affine matrix, false for projective ones that need the divide
+static bool affineRows(const QMatrix4x4& matrix, float (&affine)[3][4]){
+    if(matrix(3, 0) != 0 || matrix(3, 1) != 0 || matrix(3, 2) != 0 || matrix(3, 3) != 1)
+        return false;
+    for(int r = 0; r < 3; ++r){
+        for(int c = 0; c < 4; ++c)
+            affine[r][c] = matrix(r, c);
+    }
+    return true;
+}
+
+// affine matrices go through the batch transform
+static void transformVertices(const QMatrix4x4& matrix, geometry::Vec3Array& vertices){
+    float affine[3][4];
+    if(affineRows(matrix, affine)){
+        vertices.transform(affine);
+        return;
+    }
+    for(size_t i = 0; i < vertices.size(); ++i)
+        vertices.set(i, mapVector(matrix, vertices[i]));
+}
+
+geometry::Vec3Array Model::getWorldVertices() const {
+    geometry::Vec3Array result = _vertices;
+    if(!_transform.isIdentity())
+        transformVertices(_transform, result);
+    return result;
+}
+
+geometry::Vec3<double> Model::getWorldVertexSum() const {
+    if(_transform.isIdentity())
+        return _vertices.sum();
+    float affine[3][4];
+    if(affineRows(_transform, affine))
+        return _vertices.sum(affine);
+    geometry::Vec3<double> sum(0, 0, 0);
+    for(size_t i = 0; i < _vertices.size(); ++i){
+        geometry::Vec3<float> v = mapVector(_transform, _vertices[i]);
+        sum += geometry::Vec3<double>(v.x, v.y, v.z);
+    }
+    return sum;
+}
+
+geometry::BoundingBox<float> Model::getWorldBounds() const {
+    if(_transform.isIdentity())
+        return _vertices.bounds();
+    float affine[3][4];
+    if(affineRows(_transform, affine))
+        return _vertices.bounds(affine);
+    geometry::BoundingBox<float> bounds;
+    for(size_t i = 0; i < _vertices.size(); ++i)
+        bounds.extend(mapVector(_transform, _vertices[i]));
+    return bounds;
+}
+
+float Model::getWorldMaxDistanceSquared(const geometry::Vec3<float>& center) const {
+    if(_transform.isIdentity())
+        return _vertices.maxDistanceSquared(center);
+    float affine[3][4];
+    if(affineRows(_transform, affine))
+        return _vertices.maxDistanceSquared(center, affine);
+    float max = 0;
+    for(size_t i = 0; i < _vertices.size(); ++i)
+        max = std::max(max, (mapVector(_transform, _vertices[i]) - center).lengthSquared());
+    return max;
+}
+
+void Model::bakeTransform(){
+    if(_transform.isIdentity())
+        return;
+    transformVertices(_transform, _vertices);
+    QMatrix3x3 normalMatrix = _transform.normalMatrix();
+    for(auto & n : _normals){
+        n = {normalMatrix(0, 0) * n.x + normalMatrix(0, 1) * n.y + normalMatrix(0, 2) * n.z,
+             normalMatrix(1, 0) * n.x + normalMatrix(1, 1) * n.y + normalMatrix(1, 2) * n.z,
+             normalMatrix(2, 0) * n.x + normalMatrix(2, 1) * n.y + normalMatrix(2, 2) * n.z};
+    }
+    _transform.setToIdentity();
+    _geometryDirty = true;
+}
+
+void Model::setStreaming(bool streaming){
+    if(_streaming == streaming)
+        return;
+    _streaming = streaming;
+    // usage pattern is fixed at buffer creation
+    _GPUattributes.destroy();
+    _geometryDirty = true;
+}
+
+void Model::updateVertices(size_t first, size_t count){
+    if(count == 0)
+        return;
+    _dirtyFirst = std::min(_dirtyFirst, first);
+    _dirtyLast = std::max(_dirtyLast, first + count);
+}
+
+void Model::setLods(const std::vector<mesh_simplifier::Level>& levels){
+    _lods.clear();
+    _lodIndices.clear();
+    for(const auto& level : levels){
+        _lods.push_back({_indices.size() + _lodIndices.size(), level.indices.size(), level.error});
+        _lodIndices.insert(_lodIndices.end(), level.indices.begin(), level.indices.end());
     }
-    if(_onGPU)
-        loadPosition();
+    _indicesDirty = true;
 }
 
-QMatrix4x4 Model::getMatrix(){
-    return {};
+float Model::getScale() const {
+    return _transform.mapVector(QVector3D(1, 0, 0)).length();
 }
 
-void Model::draw() {
+void Model::draw(RenderStats* stats, const Frustum* frustum, const LodSelector* lod) {
     if (!_onGPU) loadToGPU();
+    else if (_geometryDirty) uploadGeometry();
+    else flushVertices();
+    if (_indicesDirty) {
+        _GPUmodel.bind();
+        uploadIndices();
+        _GPUmodel.release();
+    }
+    if (frustum && !frustum->intersects(_bounds, _transform)) return;
+    size_t level = lod ? lod->select(_lods, transformBox(_bounds, _transform), getScale()) : 0;
     _GPUprogram.bind();
     _GPUmodel.bind();
     _GPUindices.bind();
     _GPUprogram.setUniformValue("color", _color.x, _color.y, _color.z);
-    glDrawElements(GL_TRIANGLES, _GPUindices.size(), GL_UNSIGNED_INT, 0);
+    _GPUprogram.setUniformValue("modelMatrix", _transform);
+    _GPUprogram.setUniformValue("normalMatrix", _transform.normalMatrix());
+    if (level > 0) {
+        drawRange(_lods[level - 1].firstIndex, _lods[level - 1].indexCount, stats);
+    } else {
+        size_t first = 0;
+        size_t count = 0;
+        for (const auto& chunk : _chunks) {
+            if (frustum && _chunks.size() > 1 && !frustum->intersects(chunk.bounds, _transform))
+                continue;
+            if (first + count == chunk.firstIndex) {
+                count += chunk.indexCount;
+                continue;
+            }
+            drawRange(first, count, stats);
+            first = chunk.firstIndex;
+            count = chunk.indexCount;
+        }
+        drawRange(first, count, stats);
+    }
     _GPUindices.release();
     _GPUmodel.release();
     _GPUprogram.release();
 }
 
 
+void Model::drawRange(size_t first, size_t count, RenderStats* stats) {
+    if (count == 0) return;
+    glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, reinterpret_cast<const void*>(first * sizeof(unsigned int)));
+    if (stats) {
+        stats->drawCalls++;
+        stats->triangles += count / 3;
+    }
+}
+
 void Model::loadToGPU() {
+    // resolved here so models can be built and copied without a current context
+    initializeOpenGLFunctions();
     _onGPU = true;
     if (!_GPUmodel.isCreated()) {
         _GPUmodel.create();
     }
-    if(_indices.empty()){
-        makeIndices();
-    }
+    uploadGeometry();
+}
+
+void Model::uploadGeometry() {
+    makeIndices();
+    updateBounds();
     _GPUmodel.bind();
+    uploadIndices();
+    loadAttributes();
+    _GPUmodel.release();
+    _geometryDirty = false;
+    _dirtyFirst = std::numeric_limits<size_t>::max();
+    _dirtyLast = 0;
+}
 
-    createGPUbuffer(_GPUindices, _indices, QOpenGLBuffer::StaticDraw);
+void Model::uploadIndices() {
+    if (_lodIndices.empty()) {
+        createGPUbuffer(_GPUindices, _indices, QOpenGLBuffer::StaticDraw);
+    } else {
+        std::vector<unsigned int> all(_indices);
+        all.insert(all.end(), _lodIndices.begin(), _lodIndices.end());
+        createGPUbuffer(_GPUindices, all, QOpenGLBuffer::StaticDraw);
+    }
     _GPUindices.release();
+    _indicesDirty = false;
+}
 
-    loadPosition();
-    loadNormal();
-    _GPUmodel.release();
+void Model::flushVertices() {
+    if(_dirtyFirst >= _dirtyLast)
+        return;
+    size_t last = std::min(_dirtyLast, _vertices.size());
+    if(_dirtyFirst < last){
+        std::vector<GPUVertex> staging = packVertices(_dirtyFirst, last);
+        _GPUattributes.bind();
+        _GPUattributes.write(_dirtyFirst * sizeof(GPUVertex), staging.data(), staging.size() * sizeof(GPUVertex));
+        _GPUattributes.release();
+        updateBounds(_dirtyFirst, last);
+    }
+    _dirtyFirst = std::numeric_limits<size_t>::max();
+    _dirtyLast = 0;
 }
 
 void Model::deleteFromGPU() {
     _onGPU = false;
+    _geometryDirty = true;
     _GPUmodel.destroy();
-    _GPUvertices.destroy();
-    _GPUnormals.destroy();
+    _GPUattributes.destroy();
     _GPUindices.destroy();
-    _GPUtexture.destroy();
 }
 
 void Model::clear() {
     deleteFromGPU();
     _indices.clear();
+    _chunks.clear();
+    _vertexChunkOffsets.clear();
+    _vertexChunks.clear();
+    _bounds = {};
+    _lods.clear();
+    _lodIndices.clear();
     _vertices.clear();
     _normals.clear();
 }
 
 template <typename T>
 void Model::createGPUbuffer(QOpenGLBuffer& buff, const std::vector<T>& data, QOpenGLBuffer::UsagePattern usage) {
-    if (buff.isCreated()) {
-        buff.bind();
-        return;
+    if (!buff.isCreated()) {
+        buff.create();
+        buff.setUsagePattern(usage);
     }
-    buff.create();
     buff.bind();
-    buff.setUsagePattern(usage);
+    if (usage != QOpenGLBuffer::StaticDraw) {
+        // orphan the old storage so the driver does not stall on in-flight frames
+        buff.allocate(data.size() * sizeof(T));
+        buff.write(0, data.data(), data.size() * sizeof(T));
+        return;
+    }
     buff.allocate(data.data(), data.size() * sizeof(T));
 }
 
@@ -150,12 +356,15 @@ static bool getIndex(
 }
 
 void Model::makeIndices(){
-    std::vector<geometry::Vec3<float>> new_vertices;
+    if(!_indices.empty())
+        return;
+    geometry::Vec3Array new_vertices;
     std::vector<geometry::Vec3<float>> new_normals;
     std::vector<geometry::Vec3<float>> new_textures;
 
     _indices.clear();
     std::map<IndexPack, unsigned int> packToIndex;
+    new_vertices.reserve(_vertices.size());
     unsigned int index;
 	for ( const auto& packed : _indexPacks){
         if ( !getIndex( packed, packToIndex, index) ){
@@ -174,22 +383,149 @@ void Model::makeIndices(){
     swap(_vertices, new_vertices);
     swap(_textures, new_textures);
     swap(_normals, new_normals);
+    buildChunks();
+
+    // packs follow the expanded arrays, so code reading packs sees the same
+    // triangles as the indices
+    bool hasTextures = _textures.size() == _vertices.size();
+    bool hasNormals = _normals.size() == _vertices.size();
+    _indexPacks.clear();
+    _indexPacks.reserve(_indices.size());
+    for (unsigned int i : _indices) {
+        _indexPacks.emplace_back(i, i, i);
+        if (!hasTextures)
+            _indexPacks.back().texture.reset();
+        if (!hasNormals)
+            _indexPacks.back().normal.reset();
+    }
 }
 
-void Model::loadPosition(){
-    _GPUmodel.bind();
-    createGPUbuffer(_GPUvertices, _vertices, QOpenGLBuffer::StaticDraw);
-    _GPUprogram.enableAttributeArray("position");
-    _GPUprogram.setAttributeBuffer("position", GL_FLOAT, 0, 3, 0);
-    _GPUvertices.release();
-    _GPUmodel.release();
+void Model::buildChunks(){
+    size_t triangles = _indices.size() / 3;
+    if (triangles > 2 * chunkTriangles)
+        sortTrianglesSpatially();
+    _chunks.clear();
+    _vertexChunkOffsets.clear();
+    _vertexChunks.clear();
+    for (size_t first = 0; first < triangles; first += chunkTriangles) {
+        size_t count = std::min(chunkTriangles, triangles - first);
+        _chunks.push_back({first * 3, count * 3, {}});
+    }
+    updateBounds();
 }
 
-void Model::loadNormal(){
+// spreads the lower 10 bits of v so that two zero bits follow each of them
+static unsigned int spreadBits(unsigned int v){
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+void Model::sortTrianglesSpatially(){
+    geometry::BoundingBox<float> bounds = _vertices.bounds();
+    geometry::Vec3<float> size = bounds.size();
+    float extent = std::max({size.x, size.y, size.z, std::numeric_limits<float>::min()});
+
+    size_t triangles = _indices.size() / 3;
+    std::vector<std::pair<unsigned int, unsigned int>> keys(triangles);
+    for (size_t t = 0; t < triangles; ++t) {
+        auto centroid = (_vertices[_indices[3 * t]] + _vertices[_indices[3 * t + 1]] + _vertices[_indices[3 * t + 2]]) / 3.0f;
+        auto cell = (centroid - bounds.min) * (1023.0f / extent);
+        keys[t] = {spreadBits(static_cast<unsigned int>(cell.x)) << 2
+                 | spreadBits(static_cast<unsigned int>(cell.y)) << 1
+                 | spreadBits(static_cast<unsigned int>(cell.z)),
+                   static_cast<unsigned int>(t)};
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<unsigned int> sorted(_indices.size());
+    for (size_t t = 0; t < triangles; ++t) {
+        std::copy_n(_indices.begin() + 3 * keys[t].second, 3, sorted.begin() + 3 * t);
+    }
+    _indices.swap(sorted);
+}
+
+void Model::updateBounds(){
+    _bounds = {};
+    for (auto& chunk : _chunks) {
+        chunk.bounds = {};
+        for (size_t i = chunk.firstIndex; i < chunk.firstIndex + chunk.indexCount; ++i) {
+            chunk.bounds.extend(_vertices[_indices[i]]);
+        }
+        _bounds.extend(chunk.bounds);
+    }
+}
+
+void Model::updateBounds(size_t first, size_t last){
+    if (_vertexChunkOffsets.size() != _vertices.size() + 1) {
+        _vertexChunkOffsets.assign(_vertices.size() + 1, 0);
+        std::vector<std::pair<unsigned int, unsigned int>> uses;
+        for (size_t c = 0; c < _chunks.size(); ++c) {
+            for (size_t i = _chunks[c].firstIndex; i < _chunks[c].firstIndex + _chunks[c].indexCount; ++i)
+                uses.emplace_back(_indices[i], static_cast<unsigned int>(c));
+        }
+        std::sort(uses.begin(), uses.end());
+        uses.erase(std::unique(uses.begin(), uses.end()), uses.end());
+        _vertexChunks.resize(uses.size());
+        for (size_t u = 0; u < uses.size(); ++u) {
+            _vertexChunkOffsets[uses[u].first + 1]++;
+            _vertexChunks[u] = uses[u].second;
+        }
+        for (size_t v = 0; v < _vertices.size(); ++v)
+            _vertexChunkOffsets[v + 1] += _vertexChunkOffsets[v];
+    }
+    std::vector<char> touched(_chunks.size(), 0);
+    for (size_t v = first; v < last; ++v) {
+        for (unsigned int u = _vertexChunkOffsets[v]; u < _vertexChunkOffsets[v + 1]; ++u)
+            touched[_vertexChunks[u]] = 1;
+    }
+    _bounds = {};
+    for (size_t c = 0; c < _chunks.size(); ++c) {
+        auto& chunk = _chunks[c];
+        if (touched[c]) {
+            chunk.bounds = {};
+            for (size_t i = chunk.firstIndex; i < chunk.firstIndex + chunk.indexCount; ++i)
+                chunk.bounds.extend(_vertices[_indices[i]]);
+        }
+        _bounds.extend(chunk.bounds);
+    }
+}
+
+std::vector<GPUVertex> Model::packVertices(size_t first, size_t last) const {
+    std::vector<GPUVertex> result(last - first);
+    bool hasNormals = _normals.size() >= last;
+    bool hasTextures = _textures.size() >= last;
+    const float* x = _vertices.x();
+    const float* y = _vertices.y();
+    const float* z = _vertices.z();
+    for(size_t i = first; i < last; ++i){
+        GPUVertex& out = result[i - first];
+        out.position[0] = x[i];
+        out.position[1] = y[i];
+        out.position[2] = z[i];
+        const auto n = hasNormals ? _normals[i] : geometry::Vec3<float>(0, 0, 0);
+        out.normal[0] = n.x;
+        out.normal[1] = n.y;
+        out.normal[2] = n.z;
+        const auto t = hasTextures ? _textures[i] : geometry::Vec3<float>(0, 0, 0);
+        out.texture[0] = t.x;
+        out.texture[1] = t.y;
+    }
+    return result;
+}
+
+void Model::loadAttributes(){
     _GPUmodel.bind();
-    createGPUbuffer(_GPUnormals, _normals, QOpenGLBuffer::StaticDraw);
+    createGPUbuffer(_GPUattributes, packVertices(0, _vertices.size()),
+                    _streaming ? QOpenGLBuffer::DynamicDraw : QOpenGLBuffer::StaticDraw);
+    _GPUprogram.enableAttributeArray("position");
+    _GPUprogram.setAttributeBuffer("position", GL_FLOAT, offsetof(GPUVertex, position), 3, sizeof(GPUVertex));
     _GPUprogram.enableAttributeArray("normal");
-    _GPUprogram.setAttributeBuffer("normal", GL_FLOAT, 0, 3, 0);
-    _GPUnormals.release();
+    _GPUprogram.setAttributeBuffer("normal", GL_FLOAT, offsetof(GPUVertex, normal), 3, sizeof(GPUVertex));
+    _GPUprogram.enableAttributeArray("texture");
+    _GPUprogram.setAttributeBuffer("texture", GL_FLOAT, offsetof(GPUVertex, texture), 2, sizeof(GPUVertex));
+    _GPUattributes.release();
     _GPUmodel.release();
 }
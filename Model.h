@@ -5,14 +5,21 @@
 #include <sstream>
 #include <optional>
 #include <memory>
+#include <limits>
 
 #include <QOpenGLFunctions>
 #include <QOpenGLBuffer>
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
+#include <QMatrix4x4>
 
 #include "Geometry.h"
+#include "Vec3Array.h"
+#include "RenderStats.h"
+#include "Frustum.h"
+#include "LodSelector.h"
+#include "remesher/mesh_simplifier.hpp"
 
 struct IndexPack{
     unsigned int vertex;
@@ -24,23 +31,22 @@ struct IndexPack{
         , texture(t)
         , normal(n) { }
 
-    IndexPack(const std::string &segment, unsigned int vc=0, unsigned int nc=0, unsigned int tc=0){
+    // OBJ face corner, indices stay global to the file; 0 wraps to a value the
+    // loader rejects as a missing attribute
+    IndexPack(const std::string &segment){
         std::stringstream ssSegment(segment);
         if(!(ssSegment >> vertex))
             throw(std::invalid_argument("failed to read source"));
         vertex--;
-        vertex -= vc;
         char trash;
         trash = ssSegment.get();
         unsigned int loader;
-        if(ssSegment.peek() != '/') {
-            ssSegment >> loader;
-            texture = loader - 1 - tc;
-        }
+        if(ssSegment.peek() != '/' && ssSegment >> loader)
+            texture = loader - 1;
         
         trash = ssSegment.get();
         if(ssSegment >> loader)
-            normal = loader - 1 - nc;
+            normal = loader - 1;
     };
 
     friend bool operator<(const IndexPack & a,const IndexPack & b){
@@ -50,6 +56,27 @@ struct IndexPack{
     };
 };
 
+// one interleaved element of the vertex buffer
+struct GPUVertex{
+    float position[3];
+    float normal[3];
+    float texture[2];
+};
+
+// contiguous run of triangles in the index buffer with its object space bounds
+struct MeshChunk{
+    size_t firstIndex;
+    size_t indexCount;
+    geometry::BoundingBox<float> bounds;
+};
+
+// simplified level stored behind the full mesh in the index buffer
+struct LodRange{
+    size_t firstIndex;
+    size_t indexCount;
+    float error;
+};
+
 class Model : protected QOpenGLFunctions{
 public:
     Model(QOpenGLShaderProgram& program);
@@ -61,8 +88,24 @@ public:
 
     void uniformScale(float ratio);
     void translate(geometry::Vec3<float> translation);
-    QMatrix4x4 getMatrix();
-    void draw();
+    void setMatrix(const QMatrix4x4& matrix) { _transform = matrix; }
+    QMatrix4x4 getMatrix() const { return _transform; }
+    // applies the model matrix to the stored geometry and resets it to identity
+    void bakeTransform();
+    // geometry edited through the non-const getters reaches the GPU only after this call
+    void updateGeometry() { _geometryDirty = true; }
+    // keeps the vertex buffer in dynamic storage so updateVertices is cheap
+    void setStreaming(bool streaming);
+    // marks vertices [first, first + count) for a sub-range upload on the next draw
+    void updateVertices(size_t first, size_t count);
+    // expands index packs into GPU vertices and rewrites the packs to match;
+    // done by loadToGPU when needed
+    void makeIndices();
+    // interleaved GPU layout of vertices [first, last)
+    std::vector<GPUVertex> packVertices(size_t first, size_t last) const;
+    // chunks outside the frustum are skipped and a simplified level is used
+    // when the selector allows it
+    void draw(RenderStats* stats = nullptr, const Frustum* frustum = nullptr, const LodSelector* lod = nullptr);
     void loadToGPU();
     void deleteFromGPU();
     void clear();
@@ -73,11 +116,19 @@ public:
     void addIndexPack(const IndexPack& p) { _indexPacks.push_back(p); }
     void setColor(geometry::Vec3<float> color) { _color = color; }
     void setName(const std::string& name) { _name = name; }
-
-    const geometry::Vec3<float> &getVertex(unsigned int index) const { return _vertices.at(index); }
-    geometry::Vec3<float> &getVertex(unsigned int index) { return _vertices.at(index); }
-    const std::vector<geometry::Vec3<float>>& getVertices() const { return _vertices; }
-    std::vector<geometry::Vec3<float>>& getVertices() { return _vertices; }
+    geometry::Vec3<float> getColor() const { return _color; }
+    const std::string& getName() const { return _name; }
+
+    geometry::Vec3<float> getVertex(unsigned int index) const { return _vertices.at(index); }
+    geometry::Vec3<float> getWorldVertex(unsigned int index) const;
+    // copy of the positions with the model matrix applied
+    geometry::Vec3Array getWorldVertices() const;
+    // reductions over the world space positions, without the copy
+    geometry::Vec3<double> getWorldVertexSum() const;
+    geometry::BoundingBox<float> getWorldBounds() const;
+    float getWorldMaxDistanceSquared(const geometry::Vec3<float>& center) const;
+    const geometry::Vec3Array& getVertices() const { return _vertices; }
+    geometry::Vec3Array& getVertices() { return _vertices; }
 
     const std::vector<geometry::Vec3<float>>& getNormals() const { return _normals; }
     std::vector<geometry::Vec3<float>>& getNormals() { return _normals; }
@@ -91,32 +142,63 @@ public:
     const std::vector<IndexPack>& getIndexPacks() const { return _indexPacks; }
     std::vector<IndexPack>& getIndexPacks() { return _indexPacks; }
 
+    const std::vector<MeshChunk>& getChunks() const { return _chunks; }
+    const geometry::BoundingBox<float>& getBounds() const { return _bounds; }
+
+    // levels must come from the current indices, see mesh_simplifier::buildLodChain
+    void setLods(const std::vector<mesh_simplifier::Level>& levels);
+    const std::vector<LodRange>& getLods() const { return _lods; }
+    const std::vector<unsigned int>& getLodIndices() const { return _lodIndices; }
+    float getScale() const;
+
+    // models above twice this size are split into spatially sorted chunks
+    static constexpr size_t chunkTriangles = 16384;
+
 
 private:
     template <typename T>
     void createGPUbuffer(QOpenGLBuffer& buff, const std::vector<T>& data, QOpenGLBuffer::UsagePattern usage);
-    void makeIndices();
-    void loadPosition();
-    void loadNormal();
+    void uploadGeometry();
+    void flushVertices();
+    void uploadIndices();
+    void drawRange(size_t first, size_t count, RenderStats* stats);
+    void buildChunks();
+    void sortTrianglesSpatially();
+    void updateBounds();
+    // bounds of only the chunks that use vertices [first, last)
+    void updateBounds(size_t first, size_t last);
+    void loadAttributes();
 
     bool _onGPU = false;
+    bool _geometryDirty = true;
+    bool _streaming = false;
+    size_t _dirtyFirst = std::numeric_limits<size_t>::max();
+    size_t _dirtyLast = 0;
     QOpenGLShaderProgram& _GPUprogram;
-    QOpenGLBuffer _GPUvertices;
-    QOpenGLBuffer _GPUnormals;
+    QOpenGLBuffer _GPUattributes;
     QOpenGLBuffer _GPUindices;
-    QOpenGLBuffer _GPUtexture;
     QOpenGLVertexArrayObject _GPUmodel;
 
     
     geometry::Vec3<float> _color = {0.3,0.3,0.3};
+    QMatrix4x4 _transform;
 
     std::string _name;
 
-    std::vector<geometry::Vec3<float>> _vertices;
+    geometry::Vec3Array _vertices;
     std::vector<geometry::Vec3<float>> _normals;
     std::vector<geometry::Vec3<float>> _textures;
     std::vector<IndexPack> _indexPacks;
     std::vector<unsigned int> _indices;
+    std::vector<MeshChunk> _chunks;
+    // chunks using vertex v are _vertexChunks[_vertexChunkOffsets[v] .. _vertexChunkOffsets[v + 1]),
+    // built on the first partial bounds update
+    std::vector<unsigned int> _vertexChunkOffsets;
+    std::vector<unsigned int> _vertexChunks;
+    geometry::BoundingBox<float> _bounds;
+    std::vector<LodRange> _lods;
+    std::vector<unsigned int> _lodIndices;
+    bool _indicesDirty = false;
 
 }; 
 
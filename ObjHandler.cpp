@@ -2,23 +2,30 @@
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
+#include <iomanip>
+#include <limits>
+#include <algorithm>
 
 #include <QOpenGLShaderProgram>
 
 #include "ObjHandler.h"
 #include "Model.h"
 #include "Geometry.h"
+#include "remesher/mesh_normals.hpp"
+#include "remesher/mesh_weld.hpp"
 
-std::vector<Model> ObjHandler::loadObj(const std::string& filepath, QOpenGLShaderProgram& program) {
+std::vector<Model> ObjHandler::loadObj(const std::string& filepath, QOpenGLShaderProgram& program,
+                                       const LoadOptions& options) {
 
     std::vector<Model> models;
-    ObjHandler::loadObj(filepath, program, models);
+    ObjHandler::loadObj(filepath, program, models, options);
     return models;
 }
 
 void ObjHandler::loadObj(const std::string& filepath,
                          QOpenGLShaderProgram& program,
-                         std::vector<Model>& models) {
+                         std::vector<Model>& models,
+                         const LoadOptions& options) {
 
     std::ifstream file(filepath);
     if (!file) {
@@ -26,26 +33,100 @@ void ObjHandler::loadObj(const std::string& filepath,
     }
     std::string line;
 
+    size_t firstModel = models.size();
+    // face indices are global to the file and may point at attributes read
+    // before an earlier object started, so all attributes go to one pool and
+    // every model takes the ones its faces use once the file is read
+    Model pool(program);
     models.emplace_back(program);
     while(std::getline(file, line)) {
         if (line.empty()) continue;
         std::stringstream ss(line);
         switch(ss.get()) {
             case 'v':
-                handleVertexAttribute(models.back(), ss);
+                handleVertexAttribute(pool, ss);
                 break;
             case 'f':
                 handleFace(models.back(), ss);
                 break;
-            case 'o':
-                models.emplace_back(program);
+            case 'o': {
+                if (!models.back().getIndexPacks().empty())
+                    models.emplace_back(program);
+                std::string name;
+                ss >> name;
+                models.back().setName(name);
                 break;
+            }
             default:
                 break;
         }
 
     }
+    if (models.back().getIndexPacks().empty())
+        models.pop_back();
+    for (size_t i = firstModel; i < models.size(); ++i) {
+        takeAttributes(models[i], pool);
+        // before the normals, so smooth normals are shared across welded seams
+        if (options.weld)
+            mesh_weld::weldVertices(models[i], options.weldTolerance);
+        mesh_normals::fillMissingNormals(models[i]);
+    }
+
+}
 
+void ObjHandler::saveObj(const Model& model, const std::string& filepath) {
+    saveObj(std::vector<Model>{model}, filepath);
+}
+
+void ObjHandler::saveObj(const std::vector<Model>& models, const std::string& filepath) {
+    std::ofstream file(filepath);
+    if (!file) {
+        throw std::invalid_argument("invalid path to file");
+    }
+    // models are written in world space, indices are global to the file
+    file << std::setprecision(std::numeric_limits<float>::max_digits10);
+    Offsets fileCounts;
+    for (size_t m = 0; m < models.size(); ++m) {
+        Model model = models[m];
+        model.bakeTransform();
+        file << "o " << (model.getName().empty() ? "model_" + std::to_string(m) : model.getName()) << '\n';
+        for (const auto& v : model.getVertices())
+            file << "v " << v.x << ' ' << v.y << ' ' << v.z << '\n';
+        for (const auto& t : model.getTexCoords())
+            file << "vt " << t.x << ' ' << t.y << '\n';
+        for (const auto& n : model.getNormals())
+            file << "vn " << n.x << ' ' << n.y << ' ' << n.z << '\n';
+
+        // an indexed model keeps every attribute at its vertex index, whatever its packs say
+        const auto& indices = model.getIndices();
+        const auto& packs = model.getIndexPacks();
+        bool indexed = !indices.empty();
+        bool hasTextures = model.getTexCoords().size() == model.getVertices().size();
+        bool hasNormals = model.getNormals().size() == model.getVertices().size();
+        size_t corners = indexed ? indices.size() : packs.size();
+        for (size_t i = 2; i < corners; i += 3) {
+            file << 'f';
+            for (size_t corner = i - 2; corner <= i; ++corner) {
+                IndexPack p = indexed ? IndexPack(indices[corner], indices[corner], indices[corner]) : packs[corner];
+                bool texture = indexed ? hasTextures : p.texture && *p.texture < model.getTexCoords().size();
+                bool normal = indexed ? hasNormals : p.normal && *p.normal < model.getNormals().size();
+                file << ' ' << p.vertex + fileCounts.vertices + 1;
+                if (texture || normal)
+                    file << '/';
+                if (texture)
+                    file << *p.texture + fileCounts.textures + 1;
+                if (normal)
+                    file << '/' << *p.normal + fileCounts.normals + 1;
+            }
+            file << '\n';
+        }
+        fileCounts.vertices += model.getVertices().size();
+        fileCounts.textures += model.getTexCoords().size();
+        fileCounts.normals += model.getNormals().size();
+    }
+    if (!file) {
+        throw std::runtime_error("cannot write " + filepath);
+    }
 }
 
 void ObjHandler::handleVertexAttribute(Model& model, std::stringstream& line) {
@@ -72,28 +153,60 @@ void ObjHandler::handleVertexAttribute(Model& model, std::stringstream& line) {
 void ObjHandler::handleFace(Model& model, std::stringstream& line) {
     std::string segment;
     std::vector<IndexPack> specifiers;
-    while (!line.eof()){
-        line >> segment;
+    while (line >> segment){
         specifiers.emplace_back(segment);
     }
+    // faces without normals get smooth ones once the whole model is read
     for(size_t i = 2; i < specifiers.size(); i++){
-        if(!specifiers[i].normal || !specifiers[i - 1].normal || !specifiers[0].normal){
-            geometry::Vec3<float> normal = 
-                    geometry::getNormal(model.getVertex(specifiers[0].vertex), 
-                                        model.getVertex(specifiers[i - 1].vertex), 
-                                        model.getVertex(specifiers[i].vertex));
-            model.addNormal(normal);
-            unsigned long index = model.getNormals().size() - 1;
-            specifiers[0].normal = index;
-            specifiers[i - 1].normal = index;
-            specifiers[i].normal = index;
-        }
         model.addIndexPack(specifiers[0]);
         model.addIndexPack(specifiers[i-1]);
         model.addIndexPack(specifiers[i]);
     }
 
 }
+// sorted distinct indices and the position of every index among them
+static std::vector<unsigned int> usedIndices(std::vector<unsigned int> indices, size_t available, const char* kind) {
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    if (!indices.empty() && indices.back() >= available)
+        throw std::invalid_argument(std::string("face references a missing ") + kind);
+    return indices;
+}
+
+static unsigned int localIndex(const std::vector<unsigned int>& used, unsigned int index) {
+    return static_cast<unsigned int>(std::lower_bound(used.begin(), used.end(), index) - used.begin());
+}
+
+void ObjHandler::takeAttributes(Model& model, const Model& pool) {
+    auto& packs = model.getIndexPacks();
+    std::vector<unsigned int> vertices, normals, textures;
+    vertices.reserve(packs.size());
+    for (const auto& pack : packs) {
+        vertices.push_back(pack.vertex);
+        if (pack.normal)
+            normals.push_back(*pack.normal);
+        if (pack.texture)
+            textures.push_back(*pack.texture);
+    }
+    vertices = usedIndices(std::move(vertices), pool.getVertices().size(), "vertex");
+    normals = usedIndices(std::move(normals), pool.getNormals().size(), "normal");
+    textures = usedIndices(std::move(textures), pool.getTexCoords().size(), "texture coordinate");
+
+    for (unsigned int v : vertices)
+        model.addVertex(pool.getVertices()[v]);
+    for (unsigned int n : normals)
+        model.addNormal(pool.getNormals()[n]);
+    for (unsigned int t : textures)
+        model.addTexture(pool.getTexCoords()[t]);
+    for (auto& pack : packs) {
+        pack.vertex = localIndex(vertices, pack.vertex);
+        if (pack.normal)
+            pack.normal = localIndex(normals, *pack.normal);
+        if (pack.texture)
+            pack.texture = localIndex(textures, *pack.texture);
+    }
+}
+
 template <typename T>
 geometry::Vec3<T> getVec3(std::stringstream& line){
     using geometry::Vec3;
@@ -8,20 +8,32 @@
 #include <QOpenGLShaderProgram>
 
 #include "Model.h"
+#include "LoadOptions.h"
 
 class ObjHandler {
 public:
-    static std::vector<Model> loadObj(const std::string& filepath, QOpenGLShaderProgram& program);
+    static std::vector<Model> loadObj(const std::string& filepath, QOpenGLShaderProgram& program,
+                                      const LoadOptions& options = {});
     static void loadObj(const std::string& filepath,
                              QOpenGLShaderProgram& program,
-                             std::vector<Model>& models);
+                             std::vector<Model>& models,
+                             const LoadOptions& options = {});
 
-    // static void saveObj(const Model& model, const std::string& filepath);
-    // static void saveObj(const std::vector<Model>& models, const std::string& filepath);
+    static void saveObj(const Model& model, const std::string& filepath);
+    static void saveObj(const std::vector<Model>& models, const std::string& filepath);
 
 private:
+    struct Offsets {
+        unsigned int vertices = 0;
+        unsigned int normals = 0;
+        unsigned int textures = 0;
+    };
+
     static void handleVertexAttribute(Model& model, std::stringstream& line);
     static void handleFace(Model& model, std::stringstream& line);
+    // copies the attributes the faces of model use out of the file-wide pool
+    // and renumbers its index packs to them
+    static void takeAttributes(Model& model, const Model& pool);
     static void handleVertex(Model& model, std::stringstream& line);
     static void handleNormal(Model& model, std::stringstream& line);
     static void handleTexture(Model& model, std::stringstream& line);
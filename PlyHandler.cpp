@@ -0,0 +1,374 @@
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <limits>
+#include <stdexcept>
+
+#include <QOpenGLShaderProgram>
+
+#include "PlyHandler.h"
+#include "Model.h"
+#include "Geometry.h"
+#include "remesher/storage.hpp"
+#include "remesher/parallel.hpp"
+#include "remesher/mesh_weld.hpp"
+#include "remesher/mesh_normals.hpp"
+
+using storage::hostIsBigEndian;
+using storage::readRaw;
+
+std::vector<Model> PlyHandler::loadPly(const std::string& filepath, QOpenGLShaderProgram& program,
+                                       const LoadOptions& options) {
+    std::vector<Model> models;
+    PlyHandler::loadPly(filepath, program, models, options);
+    return models;
+}
+
+void PlyHandler::loadPly(const std::string& filepath,
+                         QOpenGLShaderProgram& program,
+                         std::vector<Model>& models,
+                         const LoadOptions& options) {
+    storage::MappedFile file(filepath);
+    const unsigned char* data = static_cast<const unsigned char*>(file.data());
+    const unsigned char* end = data + file.size();
+    Header header = readHeader(static_cast<const char*>(file.data()), file.size());
+    bool swap = header.bigEndian != hostIsBigEndian();
+
+    // elements are stored one after another, only vertex and face are kept
+    const Element* vertexElement = nullptr;
+    const Element* faceElement = nullptr;
+    const unsigned char* vertexData = nullptr;
+    const unsigned char* faceData = nullptr;
+    const unsigned char* at = data + header.dataOffset;
+    for (const auto& element : header.elements) {
+        if (element.name == "vertex") {
+            vertexElement = &element;
+            vertexData = at;
+        } else if (element.name == "face") {
+            faceElement = &element;
+            faceData = at;
+            // the face pass below walks the records anyway
+            if (vertexElement)
+                break;
+        }
+        bool fixed = true;
+        for (const auto& property : element.properties)
+            fixed &= !property.list;
+        if (fixed) {
+            size_t size = fixedSize(element);
+            if (size > 0 && static_cast<size_t>(end - at) / size < element.count)
+                throw std::invalid_argument("truncated PLY file");
+            at += size * element.count;
+        } else {
+            for (size_t i = 0; i < element.count; ++i)
+                at += recordSize(element, at, end, swap);
+        }
+    }
+    if (!vertexElement || !faceElement)
+        throw std::invalid_argument("PLY file without vertex or face element");
+    if (vertexElement->count > std::numeric_limits<unsigned int>::max())
+        throw std::invalid_argument("too many vertices in PLY file");
+    for (const auto& property : vertexElement->properties) {
+        if (property.list)
+            throw std::invalid_argument("PLY vertices with list properties are not supported");
+    }
+
+    std::ptrdiff_t position[3] = {propertyOffset(*vertexElement, {"x"}), propertyOffset(*vertexElement, {"y"}),
+                                  propertyOffset(*vertexElement, {"z"})};
+    std::ptrdiff_t normal[3] = {propertyOffset(*vertexElement, {"nx"}), propertyOffset(*vertexElement, {"ny"}),
+                                propertyOffset(*vertexElement, {"nz"})};
+    std::ptrdiff_t texture[2] = {propertyOffset(*vertexElement, {"u", "s", "texture_u", "texture_s"}),
+                                 propertyOffset(*vertexElement, {"v", "t", "texture_v", "texture_t"})};
+    if (position[0] < 0 || position[1] < 0 || position[2] < 0)
+        throw std::invalid_argument("PLY vertices without position");
+    bool hasNormals = normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0;
+    bool hasTexture = texture[0] >= 0 && texture[1] >= 0;
+    auto typeAt = [&](std::ptrdiff_t offset) {
+        std::ptrdiff_t current = 0;
+        for (const auto& property : vertexElement->properties) {
+            if (current == offset)
+                return property.type;
+            current += static_cast<std::ptrdiff_t>(typeSize(property.type));
+        }
+        return Type::Float32;
+    };
+    Type positionType[3] = {typeAt(position[0]), typeAt(position[1]), typeAt(position[2])};
+    Type normalType[3] = {typeAt(normal[0]), typeAt(normal[1]), typeAt(normal[2])};
+    Type textureType[2] = {typeAt(texture[0]), typeAt(texture[1])};
+    size_t vertexSize = fixedSize(*vertexElement);
+    // plain float positions at the start of each record are copied, the rest converted
+    bool packedPositions = !swap && position[0] == 0 && position[1] == 4 && position[2] == 8
+                           && positionType[0] == Type::Float32 && positionType[1] == Type::Float32
+                           && positionType[2] == Type::Float32;
+
+    models.emplace_back(program);
+    Model& model = models.back();
+    auto& vertices = model.getVertices();
+    vertices.resize(vertexElement->count);
+    if (hasNormals)
+        model.getNormals().resize(vertices.size());
+    if (hasTexture)
+        model.getTexCoords().resize(vertices.size());
+    parallel::forRange(vertices.size(), [&](size_t begin, size_t last) {
+        for (size_t i = begin; i < last; ++i) {
+            const unsigned char* record = vertexData + i * vertexSize;
+            if (packedPositions) {
+                float xyz[3];
+                std::memcpy(xyz, record, sizeof(xyz));
+                vertices.set(i, {xyz[0], xyz[1], xyz[2]});
+            } else {
+                vertices.set(i, {static_cast<float>(readScalar(record + position[0], positionType[0], swap)),
+                                 static_cast<float>(readScalar(record + position[1], positionType[1], swap)),
+                                 static_cast<float>(readScalar(record + position[2], positionType[2], swap))});
+            }
+            if (hasNormals) {
+                model.getNormals()[i] = {static_cast<float>(readScalar(record + normal[0], normalType[0], swap)),
+                                         static_cast<float>(readScalar(record + normal[1], normalType[1], swap)),
+                                         static_cast<float>(readScalar(record + normal[2], normalType[2], swap))};
+            }
+            if (hasTexture) {
+                model.getTexCoords()[i] = {static_cast<float>(readScalar(record + texture[0], textureType[0], swap)),
+                                           static_cast<float>(readScalar(record + texture[1], textureType[1], swap)), 0};
+            }
+        }
+    });
+
+    // faces vary in size, one pass finds where each starts unless all are alike
+    size_t listProperty = faceElement->properties.size();
+    for (size_t p = 0; p < faceElement->properties.size(); ++p) {
+        const Property& property = faceElement->properties[p];
+        if (property.list && (property.name == "vertex_indices" || property.name == "vertex_index"))
+            listProperty = p;
+    }
+    if (listProperty == faceElement->properties.size())
+        throw std::invalid_argument("PLY faces without vertex indices");
+    const Property& indexList = faceElement->properties[listProperty];
+    size_t listOffset = 0;
+    for (size_t p = 0; p < listProperty; ++p) {
+        if (faceElement->properties[p].list)
+            throw std::invalid_argument("PLY faces with lists before the vertex indices are not supported");
+        listOffset += typeSize(faceElement->properties[p].type);
+    }
+    size_t countSize = typeSize(indexList.countType);
+    size_t indexSize = typeSize(indexList.type);
+
+    size_t faceCount = faceElement->count;
+    std::vector<size_t> faceOffsets;
+    std::vector<size_t> firstCorners;
+    size_t uniformSize = 0;
+    size_t uniformCorners = 0;
+    bool uniform = true;
+    size_t corners = 0;
+    at = faceData;
+    for (size_t f = 0; f < faceCount; ++f) {
+        if (static_cast<size_t>(end - at) < listOffset + countSize)
+            throw std::invalid_argument("truncated PLY file");
+        size_t polygon = static_cast<size_t>(readScalar(at + listOffset, indexList.countType, swap));
+        size_t size = recordSize(*faceElement, at, end, swap);
+        size_t faceCorners = polygon >= 3 ? 3 * (polygon - 2) : 0;
+        if (f == 0) {
+            uniformSize = size;
+            uniformCorners = faceCorners;
+        }
+        if (uniform && (size != uniformSize || faceCorners != uniformCorners)) {
+            uniform = false;
+            faceOffsets.reserve(faceCount);
+            firstCorners.reserve(faceCount);
+            for (size_t g = 0; g < f; ++g) {
+                faceOffsets.push_back(g * uniformSize);
+                firstCorners.push_back(g * uniformCorners);
+            }
+        }
+        if (!uniform) {
+            faceOffsets.push_back(static_cast<size_t>(at - faceData));
+            firstCorners.push_back(corners);
+        }
+        corners += faceCorners;
+        at += size;
+    }
+
+    auto& packs = model.getIndexPacks();
+    packs.assign(corners, IndexPack(0, 0, 0));
+    std::atomic<bool> outOfRange{false};
+    parallel::forRange(faceCount, [&](size_t begin, size_t last) {
+        for (size_t f = begin; f < last; ++f) {
+            const unsigned char* record = faceData + (uniform ? f * uniformSize : faceOffsets[f]);
+            size_t first = uniform ? f * uniformCorners : firstCorners[f];
+            size_t polygon = static_cast<size_t>(readScalar(record + listOffset, indexList.countType, swap));
+            const unsigned char* indices = record + listOffset + countSize;
+            auto corner = [&](size_t k, size_t slot) {
+                double value = readScalar(indices + k * indexSize, indexList.type, swap);
+                if (!(value >= 0 && value < static_cast<double>(vertices.size()))) {
+                    outOfRange = true;
+                    value = 0;
+                }
+                IndexPack& pack = packs[first + slot];
+                pack.vertex = static_cast<unsigned int>(value);
+                if (hasTexture)
+                    pack.texture = pack.vertex;
+                else
+                    pack.texture.reset();
+                if (hasNormals)
+                    pack.normal = pack.vertex;
+                else
+                    pack.normal.reset();
+            };
+            for (size_t k = 2; k < polygon; ++k) {
+                size_t slot = 3 * (k - 2);
+                corner(0, slot);
+                corner(k - 1, slot + 1);
+                corner(k, slot + 2);
+            }
+        }
+    }, 1024);
+    if (outOfRange) {
+        models.pop_back();
+        throw std::invalid_argument("PLY face references a missing vertex");
+    }
+    if (options.weld)
+        mesh_weld::weldVertices(model, options.weldTolerance);
+    mesh_normals::fillMissingNormals(model);
+}
+
+PlyHandler::Header PlyHandler::readHeader(const char* data, size_t size) {
+    const char terminator[] = "end_header";
+    std::string text(data, std::min<size_t>(size, 1 << 16));
+    size_t headerEnd = text.find(terminator);
+    if (text.compare(0, 3, "ply") != 0 || headerEnd == std::string::npos)
+        throw std::invalid_argument("not a PLY file");
+    size_t dataOffset = text.find('\n', headerEnd);
+    if (dataOffset == std::string::npos)
+        throw std::invalid_argument("not a PLY file");
+
+    Header header;
+    header.dataOffset = dataOffset + 1;
+    std::stringstream lines(text.substr(0, headerEnd));
+    std::string line;
+    bool format = false;
+    while (std::getline(lines, line)) {
+        std::stringstream ss(line);
+        std::string keyword;
+        ss >> keyword;
+        if (keyword == "format") {
+            std::string type;
+            ss >> type;
+            if (type == "binary_little_endian")
+                header.bigEndian = false;
+            else if (type == "binary_big_endian")
+                header.bigEndian = true;
+            else
+                throw std::invalid_argument("only binary PLY files are supported");
+            format = true;
+        } else if (keyword == "element") {
+            Element element;
+            ss >> element.name >> element.count;
+            header.elements.push_back(element);
+        } else if (keyword == "property") {
+            if (header.elements.empty())
+                throw std::invalid_argument("PLY property outside of an element");
+            Property property;
+            std::string type;
+            ss >> type;
+            if (type == "list") {
+                std::string countType, itemType;
+                ss >> countType >> itemType;
+                property.list = true;
+                property.countType = parseType(countType);
+                property.type = parseType(itemType);
+            } else {
+                property.type = parseType(type);
+            }
+            ss >> property.name;
+            header.elements.back().properties.push_back(property);
+        }
+    }
+    if (!format)
+        throw std::invalid_argument("PLY file without format");
+    return header;
+}
+
+PlyHandler::Type PlyHandler::parseType(const std::string& name) {
+    if (name == "char" || name == "int8") return Type::Int8;
+    if (name == "uchar" || name == "uint8") return Type::UInt8;
+    if (name == "short" || name == "int16") return Type::Int16;
+    if (name == "ushort" || name == "uint16") return Type::UInt16;
+    if (name == "int" || name == "int32") return Type::Int32;
+    if (name == "uint" || name == "uint32") return Type::UInt32;
+    if (name == "float" || name == "float32") return Type::Float32;
+    if (name == "double" || name == "float64") return Type::Float64;
+    throw std::invalid_argument("unknown PLY type " + name);
+}
+
+size_t PlyHandler::typeSize(Type type) {
+    switch (type) {
+        case Type::Int8:
+        case Type::UInt8:
+            return 1;
+        case Type::Int16:
+        case Type::UInt16:
+            return 2;
+        case Type::Int32:
+        case Type::UInt32:
+        case Type::Float32:
+            return 4;
+        case Type::Float64:
+            return 8;
+    }
+    return 0;
+}
+
+double PlyHandler::readScalar(const unsigned char* at, Type type, bool swap) {
+    switch (type) {
+        case Type::Int8: return readRaw<int8_t>(at, swap);
+        case Type::UInt8: return readRaw<uint8_t>(at, swap);
+        case Type::Int16: return readRaw<int16_t>(at, swap);
+        case Type::UInt16: return readRaw<uint16_t>(at, swap);
+        case Type::Int32: return readRaw<int32_t>(at, swap);
+        case Type::UInt32: return readRaw<uint32_t>(at, swap);
+        case Type::Float32: return readRaw<float>(at, swap);
+        case Type::Float64: return readRaw<double>(at, swap);
+    }
+    return 0;
+}
+
+size_t PlyHandler::fixedSize(const Element& element) {
+    size_t size = 0;
+    for (const auto& property : element.properties)
+        size += typeSize(property.type);
+    return size;
+}
+
+size_t PlyHandler::recordSize(const Element& element, const unsigned char* at, const unsigned char* end, bool swap) {
+    size_t size = 0;
+    for (const auto& property : element.properties) {
+        if (!property.list) {
+            size += typeSize(property.type);
+            continue;
+        }
+        size_t countSize = typeSize(property.countType);
+        if (static_cast<size_t>(end - at) < size + countSize)
+            throw std::invalid_argument("truncated PLY file");
+        double count = readScalar(at + size, property.countType, swap);
+        if (!(count >= 0))
+            throw std::invalid_argument("negative PLY list length");
+        size += countSize + static_cast<size_t>(count) * typeSize(property.type);
+    }
+    if (static_cast<size_t>(end - at) < size)
+        throw std::invalid_argument("truncated PLY file");
+    return size;
+}
+
+std::ptrdiff_t PlyHandler::propertyOffset(const Element& element, const std::vector<std::string>& names) {
+    std::ptrdiff_t offset = 0;
+    for (const auto& property : element.properties) {
+        for (const auto& name : names) {
+            if (property.name == name)
+                return offset;
+        }
+        offset += static_cast<std::ptrdiff_t>(typeSize(property.type));
+    }
+    return -1;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <QOpenGLShaderProgram>
+
+#include "Model.h"
+#include "LoadOptions.h"
+
+// Binary little and big endian PLY. The file is mapped, vertex records are
+// converted in parallel straight into one model and faces become index packs;
+// polygons are split into fans as in ObjHandler. Normals and texture
+// coordinates are read when the vertex element has them.
+class PlyHandler {
+public:
+    static std::vector<Model> loadPly(const std::string& filepath, QOpenGLShaderProgram& program,
+                                      const LoadOptions& options = {});
+    static void loadPly(const std::string& filepath,
+                        QOpenGLShaderProgram& program,
+                        std::vector<Model>& models,
+                        const LoadOptions& options = {});
+
+private:
+    enum class Type { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+    struct Property {
+        std::string name;
+        Type type;
+        bool list = false;
+        Type countType = Type::UInt8;
+    };
+
+    struct Element {
+        std::string name;
+        size_t count = 0;
+        std::vector<Property> properties;
+    };
+
+    struct Header {
+        bool bigEndian = false;
+        size_t dataOffset = 0;
+        std::vector<Element> elements;
+    };
+
+    static Header readHeader(const char* data, size_t size);
+    static Type parseType(const std::string& name);
+    static size_t typeSize(Type type);
+    static double readScalar(const unsigned char* at, Type type, bool swap);
+    // record size of an element without list properties
+    static size_t fixedSize(const Element& element);
+    // size of the record starting at `at`, list lengths are read from the data
+    static size_t recordSize(const Element& element, const unsigned char* at, const unsigned char* end, bool swap);
+    // byte offset of a scalar property inside fixed size records, -1 when missing
+    static std::ptrdiff_t propertyOffset(const Element& element, const std::vector<std::string>& names);
+};
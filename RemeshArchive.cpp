@@ -0,0 +1,224 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+
+#include <QByteArray>
+#include <QOpenGLShaderProgram>
+
+#include "RemeshArchive.h"
+#include "Meshes.hpp"
+#include "remesher/storage.hpp"
+#include "remesher/mesh_normals.hpp"
+#include "remesher/projection_remesher.hpp"
+
+namespace {
+    void putVarint(std::vector<unsigned char>& out, uint32_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<unsigned char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<unsigned char>(value));
+    }
+
+    uint32_t getVarint(const unsigned char*& at, const unsigned char* end) {
+        uint32_t value = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (at == end)
+                throw std::invalid_argument("truncated remesh archive");
+            unsigned char byte = *at++;
+            value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw std::invalid_argument("corrupt remesh archive");
+    }
+
+    // small deltas of either sign become small unsigned numbers
+    uint32_t zigzag(int32_t value) {
+        return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    }
+
+    int32_t unzigzag(uint32_t value) {
+        return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+    }
+
+    uint32_t quantize(float value, float low, float high, uint32_t steps) {
+        float unit = high > low ? (value - low) / (high - low) : 0;
+        unit = std::min(1.0f, std::max(0.0f, unit));
+        return static_cast<uint32_t>(std::lround(unit * steps));
+    }
+
+    float dequantize(uint32_t code, float low, float high, uint32_t steps) {
+        return low + (high - low) * (static_cast<float>(code) / steps);
+    }
+}
+
+constexpr char RemeshArchive::magic[8];
+
+void RemeshArchive::save(const std::string& filepath, const Model& result, const Source& source, const Options& options) {
+    if (options.bits == 0 || options.bits > 24)
+        throw std::invalid_argument("archive precision must be 1 to 24 bits");
+    if (source.level > maxLevel)
+        throw std::invalid_argument("primitive level out of range");
+    QOpenGLShaderProgram program;
+    Model primitive = fittedPrimitive(source, program);
+    Model world = result;
+    world.bakeTransform();
+    const auto& starts = primitive.getVertices();
+    const auto& vertices = world.getVertices();
+    const auto& packs = world.getIndexPacks();
+    const auto& primitivePacks = primitive.getIndexPacks();
+    bool sameTopology = vertices.size() == starts.size() && packs.size() == primitivePacks.size();
+    for (size_t i = 0; sameTopology && i < packs.size(); ++i)
+        sameTopology = packs[i].vertex == primitivePacks[i].vertex;
+    if (!sameTopology)
+        throw std::invalid_argument("result does not have the topology of its primitive");
+
+    FileHeader header = {};
+    std::memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.primitive = static_cast<uint8_t>(source.primitive);
+    header.bits = static_cast<uint8_t>(options.bits);
+    header.compressed = options.compress;
+    header.level = source.level;
+    header.vertexCount = static_cast<uint32_t>(vertices.size());
+    header.center = source.center;
+    header.radius = source.radius;
+    geometry::BoundingBox<float> bounds = vertices.bounds();
+    if (bounds.isEmpty())
+        bounds.extend(source.center);
+    header.boundsMin = bounds.min;
+    header.boundsMax = bounds.max;
+
+    uint32_t steps = (1u << options.bits) - 1;
+    // the ray parameter is used when it is no worse than a position step
+    float positionStep = bounds.size().length() / steps;
+    std::vector<float> parameters(vertices.size());
+    bool radial = true;
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        geometry::Vec3<float> ray = source.center - starts[i];
+        float lengthSquared = ray.lengthSquared();
+        float t = lengthSquared > 0 ? geometry::dot(vertices[i] - starts[i], ray) / lengthSquared : 0;
+        parameters[i] = t;
+        if ((starts[i] + t * ray - vertices[i]).length() > 0.5f * positionStep || t < 0 || t > 1) {
+            radial = false;
+            break;
+        }
+    }
+    header.encoding = static_cast<uint8_t>(radial ? Encoding::Radial : Encoding::Positions);
+
+    std::vector<unsigned char> payload;
+    payload.reserve(vertices.size() * (radial ? 2 : 6));
+    if (radial) {
+        int32_t previous = 0;
+        for (float t : parameters) {
+            int32_t code = static_cast<int32_t>(quantize(t, 0, 1, steps));
+            putVarint(payload, zigzag(code - previous));
+            previous = code;
+        }
+    } else {
+        int32_t previous[3] = {0, 0, 0};
+        for (const auto& v : vertices) {
+            for (int axis = 0; axis < 3; ++axis) {
+                int32_t code = static_cast<int32_t>(quantize((&v.x)[axis], (&bounds.min.x)[axis], (&bounds.max.x)[axis], steps));
+                putVarint(payload, zigzag(code - previous[axis]));
+                previous[axis] = code;
+            }
+        }
+    }
+
+    QByteArray packed;
+    if (options.compress)
+        packed = qCompress(payload.data(), static_cast<int>(payload.size()));
+    const char* bytes = options.compress ? packed.constData() : reinterpret_cast<const char*>(payload.data());
+    header.payloadBytes = options.compress ? static_cast<uint64_t>(packed.size()) : payload.size();
+
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file)
+        throw std::invalid_argument("invalid path to file");
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(bytes, static_cast<std::streamsize>(header.payloadBytes));
+    if (!file)
+        throw std::runtime_error("cannot write " + filepath);
+}
+
+Model RemeshArchive::load(const std::string& filepath, QOpenGLShaderProgram& program, Source* source) {
+    storage::MappedFile file(filepath);
+    FileHeader header;
+    if (file.size() < sizeof(header))
+        throw std::invalid_argument("not a remesh archive");
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(header.magic)) != 0 || header.version != version)
+        throw std::invalid_argument("not a remesh archive");
+    if (header.payloadBytes > file.size() - sizeof(header) || header.bits == 0 || header.bits > 24
+        || header.primitive > static_cast<uint8_t>(Primitive::CubeSphere)
+        || header.encoding > static_cast<uint8_t>(Encoding::Positions) || header.level > maxLevel)
+        throw std::invalid_argument("corrupt remesh archive");
+    // checked before the primitive is built, which can take long for a bad level
+    if (header.vertexCount != primitiveVertexCount(static_cast<Primitive>(header.primitive), header.level))
+        throw std::invalid_argument("remesh archive does not match its primitive");
+
+    Source stored;
+    stored.primitive = static_cast<Primitive>(header.primitive);
+    stored.level = header.level;
+    stored.center = header.center;
+    stored.radius = header.radius;
+    Model result = fittedPrimitive(stored, program);
+    auto& vertices = result.getVertices();
+    if (vertices.size() != header.vertexCount)
+        throw std::invalid_argument("remesh archive does not match its primitive");
+
+    const unsigned char* payload = static_cast<const unsigned char*>(file.data()) + sizeof(header);
+    QByteArray unpacked;
+    if (header.compressed) {
+        unpacked = qUncompress(payload, static_cast<int>(header.payloadBytes));
+        payload = reinterpret_cast<const unsigned char*>(unpacked.constData());
+    }
+    const unsigned char* end = payload + (header.compressed ? static_cast<size_t>(unpacked.size()) : header.payloadBytes);
+
+    uint32_t steps = (1u << header.bits) - 1;
+    if (static_cast<Encoding>(header.encoding) == Encoding::Radial) {
+        int32_t code = 0;
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            code += unzigzag(getVarint(payload, end));
+            geometry::Vec3<float> ray = stored.center - vertices[i];
+            vertices.set(i, vertices[i] + dequantize(static_cast<uint32_t>(code), 0, 1, steps) * ray);
+        }
+    } else {
+        int32_t code[3] = {0, 0, 0};
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            geometry::Vec3<float> v;
+            for (int axis = 0; axis < 3; ++axis) {
+                code[axis] += unzigzag(getVarint(payload, end));
+                (&v.x)[axis] = dequantize(static_cast<uint32_t>(code[axis]), (&header.boundsMin.x)[axis],
+                                          (&header.boundsMax.x)[axis], steps);
+            }
+            vertices.set(i, v);
+        }
+    }
+    mesh_normals::recomputeNormals(result);
+    if (source)
+        *source = stored;
+    return result;
+}
+
+Model RemeshArchive::makePrimitive(Primitive primitive, unsigned int level, QOpenGLShaderProgram& program) {
+    if (primitive == Primitive::CubeSphere)
+        return CubeSphere().get(program, 1, level);
+    return IcoSphere().get(program, 1, level);
+}
+
+uint64_t RemeshArchive::primitiveVertexCount(Primitive primitive, unsigned int level) {
+    // quads: the grid points on the surface of a cube with 2^level steps per edge
+    // triangles: 20 faces, each split into 4^level with shared edges
+    uint64_t faces = uint64_t(1) << (2 * level);
+    return (primitive == Primitive::CubeSphere ? 6 : 10) * faces + 2;
+}
+
+Model RemeshArchive::fittedPrimitive(const Source& source, QOpenGLShaderProgram& program) {
+    return projection_remesher::fitToSphere(makePrimitive(source.primitive, source.level, program),
+                                            source.center, source.radius);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <type_traits>
+
+#include <QOpenGLShaderProgram>
+
+#include "Model.h"
+#include "Geometry.h"
+
+// Compact storage of remesh results. The topology of a result is the one of
+// its primitive, so only the primitive type and level, the sphere it was
+// fitted to and the quantized vertices are stored; load builds the primitive
+// again and recomputes normals. Vertices that lie on their projection ray are
+// stored as one quantized ray parameter, others as quantized positions. Both
+// are delta and varint coded and optionally deflated with qCompress.
+class RemeshArchive {
+public:
+    enum class Primitive : uint8_t { IcoSphere, CubeSphere };
+    enum class Encoding : uint8_t { Radial, Positions };
+
+    // enough to rebuild the fitted primitive the result was projected from
+    struct Source {
+        Primitive primitive = Primitive::IcoSphere;
+        unsigned int level = 3;
+        geometry::Vec3<float> center = {0, 0, 0};
+        float radius = 1;
+    };
+
+    struct Options {
+        // per quantized value, at most 24
+        unsigned int bits = 16;
+        bool compress = true;
+    };
+
+    // result must come from an unoptimized projection of source
+    static void save(const std::string& filepath, const Model& result, const Source& source, const Options& options);
+    static Model load(const std::string& filepath, QOpenGLShaderProgram& program, Source* source = nullptr);
+
+    static Model makePrimitive(Primitive primitive, unsigned int level, QOpenGLShaderProgram& program);
+    // vertices makePrimitive builds, without building it
+    static uint64_t primitiveVertexCount(Primitive primitive, unsigned int level);
+
+    // IcoSphere level 8 is already 655k vertices, as in the server
+    static constexpr unsigned int maxLevel = 8;
+
+private:
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint8_t primitive;
+        uint8_t encoding;
+        uint8_t bits;
+        uint8_t compressed;
+        uint32_t level;
+        uint32_t vertexCount;
+        geometry::Vec3<float> center;
+        float radius;
+        geometry::Vec3<float> boundsMin;
+        geometry::Vec3<float> boundsMax;
+        uint64_t payloadBytes;
+    };
+
+    static_assert(sizeof(FileHeader) == 72, "the header layout is the file format");
+    static_assert(std::is_trivially_copyable<FileHeader>::value, "headers are copied to and from disk");
+
+    static constexpr char magic[8] = "PRMESH";
+    static constexpr uint32_t version = 1;
+    // the primitive must be built the same way save and load
+    static Model fittedPrimitive(const Source& source, QOpenGLShaderProgram& program);
+};
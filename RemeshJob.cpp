@@ -0,0 +1,54 @@
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "RemeshJob.h"
+#include "remesher/projection_remesher.hpp"
+#include "remesher/mesh_normals.hpp"
+
+RemeshJob::RemeshJob(const std::vector<Model>& scene, const Model& primitive)
+    : _center(projection_remesher::sceneBBCenter(scene))
+    , _result(projection_remesher::fitToScene(scene, primitive, _center))
+    , _triangles(projection_remesher::getTriangles(scene)) {
+    // GPU vertices must match the worker's positions one to one
+    _result.makeIndices();
+    _result.setStreaming(true);
+    _positions = _result.getVertices().toVector();
+    _worker = std::thread(&RemeshJob::run, this);
+}
+
+RemeshJob::~RemeshJob() {
+    _cancelled = true;
+    if (_worker.joinable())
+        _worker.join();
+}
+
+void RemeshJob::run() {
+    for (size_t i = 0; i < _positions.size(); ++i) {
+        if (_cancelled)
+            return;
+        if (!projection_remesher::projectVertex(_positions[i], _center, _triangles.view()))
+            _positions[i] = _center;
+        _projected.store(i + 1, std::memory_order_release);
+    }
+}
+
+bool RemeshJob::poll() {
+    size_t projected = _projected.load(std::memory_order_acquire);
+    if (projected == _uploaded)
+        return false;
+    auto& vertices = _result.getVertices();
+    for (size_t i = _uploaded; i < projected; ++i)
+        vertices.set(i, _positions[i]);
+    _result.updateVertices(_uploaded, projected - _uploaded);
+    _uploaded = projected;
+    if (finished())
+        mesh_normals::recomputeNormals(_result);
+    return true;
+}
+
+float RemeshJob::getProgress() const {
+    if (_positions.empty())
+        return 1.0f;
+    return _uploaded / static_cast<float>(_positions.size());
+}
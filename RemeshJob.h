@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "Model.h"
+#include "Geometry.h"
+#include "remesher/projection_remesher.hpp"
+#include "remesher/bvh.hpp"
+
+// Projects a primitive onto a scene on a worker thread. The viewer polls the job
+// every frame and streams the vertices finished so far into the result model.
+class RemeshJob {
+public:
+    RemeshJob(const std::vector<Model>& scene, const Model& primitive);
+    ~RemeshJob();
+
+    RemeshJob(const RemeshJob&) = delete;
+    RemeshJob& operator=(const RemeshJob&) = delete;
+
+    bool poll();
+    bool finished() const { return _uploaded == _positions.size(); }
+    float getProgress() const;
+    Model& getResult() { return _result; }
+
+private:
+    void run();
+
+    geometry::Vec3<float> _center;
+    Model _result;
+    bvh::Bvh _triangles;
+    std::vector<geometry::Vec3<float>> _positions;
+    std::atomic<size_t> _projected{0};
+    std::atomic<bool> _cancelled{false};
+    size_t _uploaded = 0;
+    std::thread _worker;
+};
@@ -0,0 +1,183 @@
+#include <list>
+#include <map>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+
+#include "RemeshServer.h"
+#include "SceneLoader.h"
+#include "Meshes.hpp"
+#include "remesher/projection_remesher.hpp"
+
+namespace {
+    // IcoSphere level 8 is already 655k vertices
+    constexpr unsigned int maxLevel = 8;
+}
+
+RemeshServer::RemeshServer(size_t maxScenes, const std::string& cacheDirectory, QObject* parent)
+    : QObject(parent)
+    , _maxScenes(maxScenes) {
+    _options.cacheDirectory = cacheDirectory;
+    connect(&_server, SIGNAL(newConnection()), this, SLOT(acceptConnections()));
+}
+
+RemeshServer::~RemeshServer() {
+    // unlinks every result still held by a client
+    _results.clear();
+}
+
+bool RemeshServer::listen(const QString& name) {
+    // a socket file left behind by a crashed server would block the name
+    QLocalServer::removeServer(name);
+    return _server.listen(name);
+}
+
+void RemeshServer::acceptConnections() {
+    while (_server.hasPendingConnections()) {
+        QLocalSocket* socket = _server.nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readRequests()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(dropConnection()));
+    }
+}
+
+void RemeshServer::readRequests() {
+    auto socket = qobject_cast<QLocalSocket*>(sender());
+    if (!socket)
+        return;
+    while (socket->canReadLine()) {
+        QByteArray line = socket->readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+        QJsonParseError error;
+        QJsonDocument request = QJsonDocument::fromJson(line, &error);
+        QJsonObject reply;
+        if (!request.isObject()) {
+            reply["ok"] = false;
+            reply["error"] = QString("request is not a JSON object");
+        } else {
+            reply = handleRequest(socket, request.object());
+        }
+        socket->write(QJsonDocument(reply).toJson(QJsonDocument::Compact) + '\n');
+    }
+}
+
+void RemeshServer::dropConnection() {
+    auto socket = qobject_cast<QLocalSocket*>(sender());
+    if (!socket)
+        return;
+    _results.erase(socket);
+    socket->deleteLater();
+}
+
+QJsonObject RemeshServer::handleRequest(QLocalSocket* socket, const QJsonObject& request) {
+    QJsonObject reply;
+    if (request.contains("id"))
+        reply["id"] = request["id"];
+    if (request.contains("release")) {
+        size_t released = _results[socket].erase(request["release"].toString().toStdString());
+        reply["ok"] = released > 0;
+        if (released == 0)
+            reply["error"] = QString("unknown result");
+        return reply;
+    }
+    try {
+        QElapsedTimer timer;
+        timer.start();
+        if (!request["scene"].isString())
+            throw std::invalid_argument("missing scene path");
+        int level = request["level"].toInt(3);
+        if (level < 0 || level > static_cast<int>(maxLevel))
+            throw std::invalid_argument("level out of range");
+
+        QString projection = request["projection"].toString("ray");
+        if (projection != "ray" && projection != "closest")
+            throw std::invalid_argument("unknown projection");
+        projection_remesher::RemeshOptions options = _options;
+        options.optimizeOutput = request["optimize"].toBool(false);
+        if (projection == "closest")
+            options.projection = projection_remesher::Projection::ClosestPoint;
+        auto scene = getScene(request["scene"].toString().toStdString(), options);
+        projection_remesher::RemeshStats stats;
+        Model mesh = projection_remesher::project(*scene, makePrimitive(request["primitive"].toString("icosphere"), level), options, &stats);
+        storage::SharedMemory result = publish(mesh);
+
+        reply["ok"] = true;
+        reply["shm"] = QString::fromStdString(result.name());
+        reply["bytes"] = static_cast<qint64>(result.size());
+        reply["vertices"] = static_cast<qint64>(mesh.getVertices().size());
+        reply["indices"] = static_cast<qint64>(mesh.getIndices().size());
+        reply["fallbacks"] = static_cast<qint64>(stats.fallbackVertices);
+        reply["milliseconds"] = static_cast<qint64>(timer.elapsed());
+        _results[socket].emplace(result.name(), std::move(result));
+    } catch (const std::exception& e) {
+        reply["ok"] = false;
+        reply["error"] = QString(e.what());
+    }
+    return reply;
+}
+
+std::shared_ptr<const projection_remesher::PreparedScene> RemeshServer::getScene(
+    const std::string& path, const projection_remesher::RemeshOptions& options) {
+    QFileInfo info(QString::fromStdString(path));
+    if (!info.isFile())
+        throw std::invalid_argument("invalid path to file");
+    std::string canonical = info.canonicalFilePath().toStdString();
+    qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    for (auto it = _scenes.begin(); it != _scenes.end(); ++it) {
+        if (it->path != canonical)
+            continue;
+        // a scene first used by ray requests has no distance field yet
+        bool usable = it->scene->field || options.projection != projection_remesher::Projection::ClosestPoint;
+        if (it->modified == modified && usable) {
+            _scenes.splice(_scenes.begin(), _scenes, it);
+            return it->scene;
+        }
+        _scenes.erase(it);
+        break;
+    }
+    // projection only reads positions, welding leaves the surface unchanged
+    LoadOptions load;
+    load.weld = true;
+    std::vector<Model> models = SceneLoader::load(canonical, _program, load);
+    auto scene = std::make_shared<const projection_remesher::PreparedScene>(
+        projection_remesher::prepareScene(models, options));
+    _scenes.push_front({canonical, modified, scene});
+    while (_scenes.size() > _maxScenes)
+        _scenes.pop_back();
+    return scene;
+}
+
+Model RemeshServer::makePrimitive(const QString& type, unsigned int level) {
+    if (type == "icosphere")
+        return IcoSphere().get(_program, 1, level);
+    if (type == "cubesphere")
+        return CubeSphere().get(_program, 1, level);
+    throw std::invalid_argument("unknown primitive");
+}
+
+storage::SharedMemory RemeshServer::publish(Model& mesh) {
+    mesh.makeIndices();
+    std::vector<GPUVertex> vertices = mesh.packVertices(0, mesh.getVertices().size());
+    const std::vector<unsigned int>& indices = mesh.getIndices();
+    MeshHeader header = {meshMagic, meshVersion,
+                         static_cast<uint32_t>(vertices.size()), static_cast<uint32_t>(indices.size())};
+    size_t vertexBytes = vertices.size() * sizeof(GPUVertex);
+    size_t indexBytes = indices.size() * sizeof(unsigned int);
+
+    std::string name = "/remesher_" + std::to_string(::getpid()) + "_" + std::to_string(_nextResult++);
+    storage::SharedMemory result(name, sizeof(header) + vertexBytes + indexBytes);
+    char* data = static_cast<char*>(result.data());
+    std::memcpy(data, &header, sizeof(header));
+    std::memcpy(data + sizeof(header), vertices.data(), vertexBytes);
+    std::memcpy(data + sizeof(header) + vertexBytes, indices.data(), indexBytes);
+    return result;
+}
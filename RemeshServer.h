@@ -0,0 +1,72 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include <QObject>
+#include <QString>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonObject>
+#include <QOpenGLShaderProgram>
+
+#include "Model.h"
+#include "remesher/projection_remesher.hpp"
+#include "remesher/storage.hpp"
+
+// Resident remesh service on a local socket. Clients send one JSON object per line
+//   {"id": 7, "scene": "res/teapot.obj", "primitive": "icosphere", "level": 3}
+// and read one JSON line back. "projection": "closest" moves vertices to the
+// nearest surface point through a distance field instead of casting rays. On success it names a POSIX shared memory object
+// holding a MeshHeader followed by GPUVertex[vertexCount] and uint32 indices.
+// A result lives until the client sends {"release": name} or disconnects.
+// Prepared scenes are kept in an LRU and rebuilt when their file changes.
+class RemeshServer : public QObject {
+    Q_OBJECT
+
+public:
+    struct MeshHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+    };
+    static constexpr uint32_t meshMagic = 0x4853454d;
+    static constexpr uint32_t meshVersion = 1;
+
+    RemeshServer(size_t maxScenes = 4, const std::string& cacheDirectory = {}, QObject* parent = nullptr);
+    ~RemeshServer();
+
+    bool listen(const QString& name);
+    QString errorString() const { return _server.errorString(); }
+
+private slots:
+    void acceptConnections();
+    void readRequests();
+    void dropConnection();
+
+private:
+    struct CachedScene {
+        std::string path;
+        qint64 modified;
+        std::shared_ptr<const projection_remesher::PreparedScene> scene;
+    };
+
+    QJsonObject handleRequest(QLocalSocket* socket, const QJsonObject& request);
+    std::shared_ptr<const projection_remesher::PreparedScene> getScene(const std::string& path,
+                                                                       const projection_remesher::RemeshOptions& options);
+    Model makePrimitive(const QString& type, unsigned int level);
+    storage::SharedMemory publish(Model& mesh);
+
+    QLocalServer _server;
+    QOpenGLShaderProgram _program;
+    size_t _maxScenes;
+    projection_remesher::RemeshOptions _options;
+    // most recently used first
+    std::list<CachedScene> _scenes;
+    std::map<QLocalSocket*, std::map<std::string, storage::SharedMemory>> _results;
+    size_t _nextResult = 0;
+};
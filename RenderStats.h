@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+
+struct RenderStats {
+    unsigned int drawCalls = 0;
+    size_t triangles = 0;
+};
@@ -0,0 +1,186 @@
+#include <vector>
+#include <cstddef>
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+#include <QOpenGLShaderProgram>
+
+#include "SceneBatch.h"
+#include "Model.h"
+
+SceneBatch::SceneBatch(QOpenGLShaderProgram& program)
+    : _GPUprogram(program)
+    , _GPUvertices(QOpenGLBuffer::VertexBuffer)
+    , _GPUindices(QOpenGLBuffer::IndexBuffer) { }
+
+SceneBatch::~SceneBatch() {
+    clear();
+}
+
+void SceneBatch::initialize() {
+    if (_initialized) return;
+    initializeOpenGLFunctions();
+    _initialized = true;
+}
+
+void SceneBatch::build(std::vector<Model>& models) {
+    initialize();
+    clear();
+
+    std::vector<BatchVertex> vertices;
+    std::vector<unsigned int> indices;
+    for (size_t object = 0; object < models.size(); ++object) {
+        Model& model = models[object];
+        model.makeIndices();
+        auto packed = model.packVertices(0, model.getVertices().size());
+        unsigned int base = static_cast<unsigned int>(vertices.size());
+        for (const auto& v : packed) {
+            vertices.push_back({v, static_cast<float>(object)});
+        }
+        BatchObject batchObject = {_ranges.size(), model.getChunks().size(), model.getBounds(), model.getBounds(), 1.0f, {}};
+        for (const auto& chunk : model.getChunks()) {
+            _ranges.push_back({indices.size() + chunk.firstIndex, chunk.indexCount, chunk.bounds, chunk.bounds});
+        }
+        for (const auto& lod : model.getLods()) {
+            batchObject.lods.push_back({indices.size() + lod.firstIndex, lod.indexCount, lod.error});
+        }
+        _triangleCount += model.getIndices().size() / 3;
+        for (unsigned int index : model.getIndices()) {
+            indices.push_back(base + index);
+        }
+        for (unsigned int index : model.getLodIndices()) {
+            indices.push_back(base + index);
+        }
+        _objects.push_back(batchObject);
+    }
+
+    if (!_GPUscene.isCreated()) {
+        _GPUscene.create();
+    }
+    _GPUscene.bind();
+    _GPUvertices.create();
+    _GPUvertices.bind();
+    _GPUvertices.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    _GPUvertices.allocate(vertices.data(), vertices.size() * sizeof(BatchVertex));
+
+    const int vertexOffset = offsetof(BatchVertex, vertex);
+    _GPUprogram.enableAttributeArray("position");
+    _GPUprogram.setAttributeBuffer("position", GL_FLOAT, vertexOffset + offsetof(GPUVertex, position), 3, sizeof(BatchVertex));
+    _GPUprogram.enableAttributeArray("normal");
+    _GPUprogram.setAttributeBuffer("normal", GL_FLOAT, vertexOffset + offsetof(GPUVertex, normal), 3, sizeof(BatchVertex));
+    _GPUprogram.enableAttributeArray("texture");
+    _GPUprogram.setAttributeBuffer("texture", GL_FLOAT, vertexOffset + offsetof(GPUVertex, texture), 2, sizeof(BatchVertex));
+    _GPUprogram.enableAttributeArray("object");
+    _GPUprogram.setAttributeBuffer("object", GL_FLOAT, offsetof(BatchVertex, object), 1, sizeof(BatchVertex));
+
+    _GPUindices.create();
+    _GPUindices.bind();
+    _GPUindices.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    _GPUindices.allocate(indices.data(), indices.size() * sizeof(unsigned int));
+    _GPUscene.release();
+    _GPUvertices.release();
+    _GPUindices.release();
+
+    updateObjects(models);
+}
+
+void SceneBatch::updateObjects(const std::vector<Model>& models) {
+    initialize();
+    for (size_t object = 0; object < _objects.size() && object < models.size(); ++object) {
+        BatchObject& batchObject = _objects[object];
+        QMatrix4x4 matrix = models[object].getMatrix();
+        batchObject.bounds = transformBox(batchObject.localBounds, matrix);
+        batchObject.scale = models[object].getScale();
+        for (size_t range = batchObject.firstRange; range < batchObject.firstRange + batchObject.rangeCount; ++range) {
+            _ranges[range].bounds = transformBox(_ranges[range].localBounds, matrix);
+        }
+    }
+    int texelCount = static_cast<int>(models.size()) * objectTexels;
+    int rows = (texelCount + objectTextureWidth - 1) / objectTextureWidth;
+    std::vector<float> data(static_cast<size_t>(rows) * objectTextureWidth * 4, 0.0f);
+    for (size_t object = 0; object < models.size(); ++object) {
+        float* texel = data.data() + object * objectTexels * 4;
+        QMatrix4x4 matrix = models[object].getMatrix();
+        // column major, one column per texel
+        std::copy(matrix.constData(), matrix.constData() + 16, texel);
+        auto color = models[object].getColor();
+        texel[16] = color.x;
+        texel[17] = color.y;
+        texel[18] = color.z;
+        texel[19] = 1.0f;
+    }
+
+    if (_objectTexture == 0) {
+        glGenTextures(1, &_objectTexture);
+    }
+    glBindTexture(GL_TEXTURE_2D, _objectTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, objectTextureWidth, std::max(rows, 1), 0, GL_RGBA, GL_FLOAT,
+                 data.empty() ? nullptr : data.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void SceneBatch::addDraw(size_t first, size_t count) {
+    if (count == 0) return;
+    size_t offset = first * sizeof(unsigned int);
+    if (!_counts.empty() && reinterpret_cast<size_t>(_offsets.back()) + _counts.back() * sizeof(unsigned int) == offset) {
+        _counts.back() += static_cast<GLsizei>(count);
+        return;
+    }
+    _counts.push_back(static_cast<GLsizei>(count));
+    _offsets.push_back(reinterpret_cast<const void*>(offset));
+}
+
+void SceneBatch::draw(RenderStats* stats, const Frustum* frustum, const LodSelector* lod) {
+    _counts.clear();
+    _offsets.clear();
+    for (const auto& object : _objects) {
+        if (frustum && !frustum->intersects(object.bounds)) continue;
+        size_t level = lod ? lod->select(object.lods, object.bounds, object.scale) : 0;
+        if (level > 0) {
+            addDraw(object.lods[level - 1].firstIndex, object.lods[level - 1].indexCount);
+            continue;
+        }
+        for (size_t i = object.firstRange; i < object.firstRange + object.rangeCount; ++i) {
+            const DrawRange& range = _ranges[i];
+            if (frustum && object.rangeCount > 1 && !frustum->intersects(range.bounds)) continue;
+            addDraw(range.first, range.count);
+        }
+    }
+    if (_counts.empty()) return;
+
+    _GPUprogram.bind();
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, _objectTexture);
+    _GPUprogram.setUniformValue("objectData", 1);
+    _GPUprogram.setUniformValue("batched", true);
+    _GPUscene.bind();
+    glMultiDrawElements(GL_TRIANGLES, _counts.data(), GL_UNSIGNED_INT, _offsets.data(),
+                        static_cast<GLsizei>(_counts.size()));
+    if (stats) {
+        stats->drawCalls++;
+        for (GLsizei count : _counts) {
+            stats->triangles += count / 3;
+        }
+    }
+    _GPUscene.release();
+    _GPUprogram.setUniformValue("batched", false);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    _GPUprogram.release();
+}
+
+void SceneBatch::clear() {
+    _GPUscene.destroy();
+    _GPUvertices.destroy();
+    _GPUindices.destroy();
+    if (_objectTexture != 0) {
+        glDeleteTextures(1, &_objectTexture);
+        _objectTexture = 0;
+    }
+    _objects.clear();
+    _ranges.clear();
+    _triangleCount = 0;
+}
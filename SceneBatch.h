@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+#include <QOpenGLShaderProgram>
+
+#include "Model.h"
+#include "RenderStats.h"
+#include "Frustum.h"
+#include "LodSelector.h"
+
+// Merges static scene models into one vertex and one index buffer and draws them
+// with a single multi-draw call. Per-object model matrices and colors live in a
+// float texture that the vertex shader indexes with the object id of each vertex.
+class SceneBatch : protected QOpenGLFunctions_3_3_Core {
+public:
+    SceneBatch(QOpenGLShaderProgram& program);
+    ~SceneBatch();
+
+    SceneBatch(const SceneBatch&) = delete;
+    SceneBatch& operator=(const SceneBatch&) = delete;
+
+    void build(std::vector<Model>& models);
+    // re-reads matrices and colors, geometry stays untouched
+    void updateObjects(const std::vector<Model>& models);
+    // ranges outside the frustum are skipped and simplified levels are used
+    // when the selector allows it
+    void draw(RenderStats* stats = nullptr, const Frustum* frustum = nullptr, const LodSelector* lod = nullptr);
+    void clear();
+
+    size_t getObjectCount() const { return _objects.size(); }
+    size_t getTriangleCount() const { return _triangleCount; }
+
+private:
+    // one chunk of one object, bounds are kept in object and world space
+    struct DrawRange {
+        size_t first;
+        size_t count;
+        geometry::BoundingBox<float> localBounds;
+        geometry::BoundingBox<float> bounds;
+    };
+
+    struct BatchObject {
+        size_t firstRange;
+        size_t rangeCount;
+        geometry::BoundingBox<float> localBounds;
+        geometry::BoundingBox<float> bounds;
+        float scale;
+        std::vector<LodRange> lods;
+    };
+
+    struct BatchVertex {
+        GPUVertex vertex;
+        float object;
+    };
+
+    static constexpr int objectTexels = 5;
+    static constexpr int objectTextureWidth = 1024;
+
+    void initialize();
+    void addDraw(size_t first, size_t count);
+
+    bool _initialized = false;
+    QOpenGLShaderProgram& _GPUprogram;
+    QOpenGLBuffer _GPUvertices;
+    QOpenGLBuffer _GPUindices;
+    QOpenGLVertexArrayObject _GPUscene;
+    GLuint _objectTexture = 0;
+
+    std::vector<BatchObject> _objects;
+    std::vector<DrawRange> _ranges;
+    // per-frame multi-draw arguments, adjacent ranges are merged
+    std::vector<GLsizei> _counts;
+    std::vector<const void*> _offsets;
+    size_t _triangleCount = 0;
+};
@@ -0,0 +1,39 @@
+#include <string>
+#include <vector>
+#include <cctype>
+#include <stdexcept>
+
+#include <QOpenGLShaderProgram>
+
+#include "SceneLoader.h"
+#include "ObjHandler.h"
+#include "PlyHandler.h"
+#include "StlHandler.h"
+#include "RemeshArchive.h"
+
+std::vector<Model> SceneLoader::load(const std::string& filepath, QOpenGLShaderProgram& program,
+                                     const LoadOptions& options) {
+    std::vector<Model> models;
+    SceneLoader::load(filepath, program, models, options);
+    return models;
+}
+
+void SceneLoader::load(const std::string& filepath,
+                       QOpenGLShaderProgram& program,
+                       std::vector<Model>& models,
+                       const LoadOptions& options) {
+    size_t dot = filepath.find_last_of('.');
+    std::string extension = dot == std::string::npos ? std::string() : filepath.substr(dot + 1);
+    for (auto& c : extension)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    if (extension == "obj")
+        ObjHandler::loadObj(filepath, program, models, options);
+    else if (extension == "ply")
+        PlyHandler::loadPly(filepath, program, models, options);
+    else if (extension == "stl")
+        StlHandler::loadStl(filepath, program, models, options);
+    else if (extension == "prm")
+        models.push_back(RemeshArchive::load(filepath, program));
+    else
+        throw std::invalid_argument("unsupported scene file " + filepath);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <QOpenGLShaderProgram>
+
+#include "Model.h"
+#include "LoadOptions.h"
+
+// Picks the loader from the file extension: .obj, .ply, .stl or a .prm remesh archive.
+class SceneLoader {
+public:
+    static std::vector<Model> load(const std::string& filepath, QOpenGLShaderProgram& program,
+                                   const LoadOptions& options = {});
+    static void load(const std::string& filepath,
+                     QOpenGLShaderProgram& program,
+                     std::vector<Model>& models,
+                     const LoadOptions& options = {});
+};
@@ -0,0 +1,228 @@
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QProcess>
+#include <QStringList>
+
+#include "ShardedRemesh.h"
+#include "remesher/projection_remesher.hpp"
+#include "remesher/bvh_cache.hpp"
+#include "remesher/mesh_normals.hpp"
+#include "remesher/storage.hpp"
+
+namespace {
+    constexpr char jobMagic[8] = {'P', 'R', 'S', 'H', 'J', 'O', 'B', 0};
+    constexpr char outputMagic[8] = {'P', 'R', 'S', 'H', 'O', 'U', 'T', 0};
+    constexpr uint32_t fileVersion = 1;
+
+    void copyPath(char* target, size_t length, const std::string& path) {
+        if (path.size() >= length)
+            throw std::invalid_argument("path too long: " + path);
+        std::memset(target, 0, length);
+        std::memcpy(target, path.data(), path.size());
+    }
+}
+
+size_t ShardedRemesh::shardBegin(size_t vertexCount, unsigned int shardCount, unsigned int shard) {
+    return vertexCount * shard / shardCount;
+}
+
+uint32_t ShardedRemesh::doneMarker(unsigned int shard) {
+    return 0x444f4e45u ^ shard;
+}
+
+void ShardedRemesh::writeJob(const std::string& path, const JobHeader& header,
+                             const std::vector<geometry::Vec3<float>>& positions) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(positions.data()), sizeof(geometry::Vec3<float>) * positions.size());
+    if (!out)
+        throw std::runtime_error("cannot write job file " + path);
+}
+
+std::vector<unsigned int> ShardedRemesh::runShards(const QString& program, const std::string& jobPath,
+                                                   const std::vector<unsigned int>& shards, int timeout) {
+    QElapsedTimer clock;
+    clock.start();
+    std::vector<std::unique_ptr<QProcess>> processes;
+    for (unsigned int shard : shards) {
+        processes.emplace_back(new QProcess());
+        processes.back()->setProcessChannelMode(QProcess::ForwardedChannels);
+        processes.back()->start(program, QStringList() << "--shard-worker"
+                                                       << QString::fromStdString(jobPath)
+                                                       << QString::number(shard));
+    }
+    std::vector<unsigned int> failed;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        QProcess& process = *processes[i];
+        int remaining = static_cast<int>(std::max<qint64>(0, timeout - clock.elapsed()));
+        bool finished = process.waitForFinished(remaining);
+        if (!finished) {
+            // a hung worker is retried like a crashed one
+            process.kill();
+            process.waitForFinished(-1);
+        }
+        if (!finished || process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+            failed.push_back(shards[i]);
+    }
+    return failed;
+}
+
+Model ShardedRemesh::run(const std::vector<Model>& scene, const Model& primitive, const Options& options,
+                         projection_remesher::PreparedScene* prepared) {
+    using namespace projection_remesher;
+    unsigned int shardCount = std::max(1u, options.workers);
+    Vec3<float> center = sceneBBCenter(scene);
+    float radius = sceneRadius(center, scene);
+    Model result = fitToSphere(primitive, center, radius);
+    const auto& positions = result.getVertices();
+
+    // workers map the same cache file a later single process run would
+    auto hierarchy = bvh_cache::CachedBvh::load(getTriangles(scene), center, options.workDirectory);
+    std::string hierarchyPath = bvh_cache::cachePath(options.workDirectory, hierarchy.getHash());
+    if (::access(hierarchyPath.c_str(), R_OK) != 0)
+        throw std::runtime_error("cannot store the scene hierarchy in " + options.workDirectory);
+
+    std::string unique = std::to_string(::getpid()) + "_" + std::to_string(reinterpret_cast<uintptr_t>(&result));
+    std::string jobPath = options.workDirectory + "/job_" + unique + ".bin";
+    std::string outputPath = options.workDirectory + "/shards_" + unique + ".bin";
+
+    JobHeader job = {};
+    std::memcpy(job.magic, jobMagic, sizeof(jobMagic));
+    job.version = fileVersion;
+    job.shardCount = shardCount;
+    job.vertexCount = positions.size();
+    job.center = center;
+    job.radius = radius;
+    copyPath(job.hierarchyPath, pathLength, hierarchyPath);
+    copyPath(job.outputPath, pathLength, outputPath);
+    writeJob(jobPath, job, positions.toVector());
+
+    size_t doneOffset = sizeof(OutputHeader);
+    size_t vertexOffset = doneOffset + sizeof(uint32_t) * shardCount;
+    storage::createFile(outputPath, vertexOffset + sizeof(OutputVertex) * positions.size());
+    {
+        storage::MappedFile output(outputPath, true);
+        OutputHeader header = {};
+        std::memcpy(header.magic, outputMagic, sizeof(outputMagic));
+        header.version = fileVersion;
+        header.shardCount = shardCount;
+        header.vertexCount = positions.size();
+        std::memcpy(output.data(), &header, sizeof(header));
+        output.flush();
+    }
+
+    QString program = options.workerProgram.isEmpty() ? QCoreApplication::applicationFilePath() : options.workerProgram;
+    std::vector<unsigned int> pending;
+    for (unsigned int shard = 0; shard < shardCount; ++shard)
+        pending.push_back(shard);
+    // shards run in parallel, so the largest one bounds the wait
+    size_t shardVertices = (positions.size() + shardCount - 1) / shardCount;
+    qint64 timeout = options.baseTimeout + static_cast<qint64>(shardVertices) * 1000 / std::max(1u, options.verticesPerSecond);
+    int bounded = static_cast<int>(std::min<qint64>(timeout, std::numeric_limits<int>::max()));
+    pending = runShards(program, jobPath, pending, bounded);
+    for (unsigned int attempt = 0; attempt < options.retries && !pending.empty(); ++attempt)
+        pending = runShards(program, jobPath, pending, bounded);
+
+    auto cleanup = [&]() {
+        std::remove(jobPath.c_str());
+        std::remove(outputPath.c_str());
+    };
+    if (!pending.empty()) {
+        cleanup();
+        throw std::runtime_error("shard " + std::to_string(pending.front()) + " failed");
+    }
+
+    // a shard counts only if it marked itself done and its vertices are sane
+    {
+        storage::MappedFile output(outputPath);
+        const char* data = static_cast<const char*>(output.data());
+        OutputHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        const uint32_t* done = reinterpret_cast<const uint32_t*>(data + doneOffset);
+        const OutputVertex* vertices = reinterpret_cast<const OutputVertex*>(data + vertexOffset);
+        auto& stitched = result.getVertices();
+        float limit = radius * 1.001f + std::numeric_limits<float>::epsilon();
+        for (unsigned int shard = 0; shard < shardCount; ++shard) {
+            bool valid = done[shard] == doneMarker(shard);
+            size_t end = shardBegin(stitched.size(), shardCount, shard + 1);
+            for (size_t i = shardBegin(stitched.size(), shardCount, shard); i < end && valid; ++i) {
+                const auto& v = vertices[i];
+                if (!v.hit) {
+                    stitched.set(i, center);
+                    continue;
+                }
+                valid = std::isfinite(v.position.x) && std::isfinite(v.position.y) && std::isfinite(v.position.z)
+                        && distance(v.position, center) <= limit;
+                stitched.set(i, v.position);
+            }
+            if (!valid) {
+                cleanup();
+                throw std::runtime_error("shard " + std::to_string(shard) + " produced invalid output");
+            }
+        }
+    }
+    cleanup();
+    mesh_normals::recomputeNormals(result);
+    if (prepared) {
+        prepared->center = center;
+        prepared->radius = radius;
+        prepared->triangles = std::move(hierarchy);
+    }
+    return result;
+}
+
+int ShardedRemesh::work(const std::string& jobPath, unsigned int shard) {
+    try {
+        storage::MappedFile jobFile(jobPath);
+        JobHeader job;
+        if (jobFile.size() < sizeof(job))
+            throw std::invalid_argument("truncated job file");
+        std::memcpy(&job, jobFile.data(), sizeof(job));
+        if (std::memcmp(job.magic, jobMagic, sizeof(jobMagic)) != 0 || job.version != fileVersion
+            || jobFile.size() != sizeof(job) + sizeof(geometry::Vec3<float>) * job.vertexCount)
+            throw std::invalid_argument("invalid job file");
+        if (shard >= job.shardCount)
+            throw std::invalid_argument("shard out of range");
+        const auto* positions = reinterpret_cast<const geometry::Vec3<float>*>(
+            static_cast<const char*>(jobFile.data()) + sizeof(job));
+
+        auto hierarchy = bvh_cache::CachedBvh::open(job.hierarchyPath);
+        bvh::BvhView triangles = hierarchy.view();
+
+        storage::MappedFile output(job.outputPath, true);
+        size_t doneOffset = sizeof(OutputHeader);
+        size_t vertexOffset = doneOffset + sizeof(uint32_t) * job.shardCount;
+        if (output.size() != vertexOffset + sizeof(OutputVertex) * job.vertexCount)
+            throw std::invalid_argument("output file does not match the job");
+        char* data = static_cast<char*>(output.data());
+        auto* vertices = reinterpret_cast<OutputVertex*>(data + vertexOffset);
+
+        size_t end = shardBegin(job.vertexCount, job.shardCount, shard + 1);
+        for (size_t i = shardBegin(job.vertexCount, job.shardCount, shard); i < end; ++i) {
+            geometry::Vec3<float> v = positions[i];
+            bool hit = projection_remesher::projectVertex(v, job.center, triangles);
+            vertices[i] = {v, hit ? 1u : 0u};
+        }
+        // vertices must reach the file before the marker claims them
+        output.flush();
+        uint32_t marker = doneMarker(shard);
+        std::memcpy(data + doneOffset + sizeof(uint32_t) * shard, &marker, sizeof(marker));
+        output.flush();
+        return 0;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "shard %u: %s\n", shard, e.what());
+        return 1;
+    }
+}
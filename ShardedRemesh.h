@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include <QString>
+
+#include "Model.h"
+#include "Geometry.h"
+#include "remesher/projection_remesher.hpp"
+
+// Projection split across worker processes. The coordinator stores the scene
+// hierarchy in the work directory and writes a job file with the fitted
+// primitive. Workers started as `remesher --shard-worker <job> <shard>` map both,
+// project their contiguous range of vertices and write it into a shared output
+// file. The coordinator then validates every shard and stitches the result.
+// Only files are shared, so the work directory may live on a network mount.
+class ShardedRemesh {
+public:
+    struct Options {
+        unsigned int workers = 4;
+        // holds the hierarchy cache, which later runs reuse, and the job files
+        std::string workDirectory = ".";
+        // started for every shard, the running executable when empty
+        QString workerProgram;
+        // a failed shard is started again this many times
+        unsigned int retries = 1;
+        // a worker still running after baseTimeout plus its share of vertices
+        // at verticesPerSecond milliseconds is killed and counts as failed
+        int baseTimeout = 60000;
+        unsigned int verticesPerSecond = 20000;
+    };
+
+    // prepared, when given, receives the sphere and the scene hierarchy the run used
+    static Model run(const std::vector<Model>& scene, const Model& primitive, const Options& options,
+                     projection_remesher::PreparedScene* prepared = nullptr);
+    // entry point of a worker process, returns the process exit code
+    static int work(const std::string& jobPath, unsigned int shard);
+
+private:
+    static constexpr size_t pathLength = 1024;
+
+    struct JobHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t shardCount;
+        uint64_t vertexCount;
+        geometry::Vec3<float> center;
+        float radius;
+        char hierarchyPath[pathLength];
+        char outputPath[pathLength];
+    };
+
+    struct OutputHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t shardCount;
+        uint64_t vertexCount;
+    };
+
+    struct OutputVertex {
+        geometry::Vec3<float> position;
+        uint32_t hit;
+    };
+
+    static size_t shardBegin(size_t vertexCount, unsigned int shardCount, unsigned int shard);
+    static uint32_t doneMarker(unsigned int shard);
+    static void writeJob(const std::string& path, const JobHeader& header, const std::vector<geometry::Vec3<float>>& positions);
+    // starts one process per shard and returns the shards that failed or ran
+    // out of time, timeout is in milliseconds from the start of the workers
+    static std::vector<unsigned int> runShards(const QString& program, const std::string& jobPath,
+                                               const std::vector<unsigned int>& shards, int timeout);
+};
@@ -0,0 +1,266 @@
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#include <QImage>
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <QVector4D>
+#include <QtMath>
+
+#include "SoftwareRenderer.h"
+#include "remesher/parallel.hpp"
+
+using geometry::Vec3;
+
+namespace {
+    uint32_t packColor(const Vec3<float>& c) {
+        auto channel = [](float v) { return static_cast<uint32_t>(std::lround(std::min(1.0f, std::max(0.0f, v)) * 255)); };
+        return 0xff000000u | channel(c.x) << 16 | channel(c.y) << 8 | channel(c.z);
+    }
+
+    Vec3<float> transformNormal(const QMatrix3x3& m, const Vec3<float>& n) {
+        return {m(0, 0) * n.x + m(0, 1) * n.y + m(0, 2) * n.z,
+                m(1, 0) * n.x + m(1, 1) * n.y + m(1, 2) * n.z,
+                m(2, 0) * n.x + m(2, 1) * n.y + m(2, 2) * n.z};
+    }
+
+    float edge(float ax, float ay, float bx, float by, float px, float py) {
+        return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+    }
+}
+
+SoftwareRenderer::SoftwareRenderer(const Options& options)
+    : _options(options) {
+    if (_options.width <= 0 || _options.height <= 0 || _options.tileSize <= 0)
+        throw std::invalid_argument("invalid image size");
+}
+
+Camera SoftwareRenderer::frame(const std::vector<Model>& models) const {
+    geometry::BoundingBox<float> bounds;
+    for (const auto& model : models)
+        bounds.extend(model.getWorldBounds());
+    Camera camera;
+    if (bounds.isEmpty())
+        return camera;
+    Vec3<float> center = bounds.center();
+    float radius = std::max(bounds.size().length() / 2, std::numeric_limits<float>::min());
+    // the narrower side of the image decides the distance
+    float aspect = static_cast<float>(_options.width) / _options.height;
+    float fieldOfView = _options.fieldOfView;
+    if (aspect < 1)
+        fieldOfView = 2 * qRadiansToDegrees(std::atan(std::tan(qDegreesToRadians(fieldOfView) / 2) * aspect));
+    camera.frame({center.x, center.y, center.z}, radius * 1.05f, fieldOfView);
+    return camera;
+}
+
+QImage SoftwareRenderer::render(const std::vector<Model>& models, const Camera& camera) const {
+    int width = _options.width, height = _options.height;
+    // near and far planes hug the scene so thumbnails of any scale keep depth precision
+    geometry::BoundingBox<float> bounds;
+    for (const auto& model : models)
+        bounds.extend(model.getWorldBounds());
+    QVector3D eye = camera.getEye();
+    float farPlane = 1000.0f, nearPlane = 0.1f;
+    if (!bounds.isEmpty()) {
+        Vec3<float> center = bounds.center();
+        float radius = bounds.size().length() / 2;
+        float distance = (QVector3D(center.x, center.y, center.z) - eye).length();
+        farPlane = std::max(distance + radius, std::numeric_limits<float>::min()) * 1.01f;
+        nearPlane = std::max(distance - radius, farPlane * 1e-4f);
+    }
+    QMatrix4x4 projection;
+    projection.perspective(_options.fieldOfView, static_cast<float>(width) / height, nearPlane, farPlane);
+    QMatrix4x4 viewProjection = projection * camera.getMatrix();
+    // main.frag normalizes the light position, so the light is a direction
+    Vec3<float> light = {eye.x(), eye.y(), eye.z()};
+    float lightLength = light.length();
+    light = lightLength > 0 ? light / lightLength : Vec3<float>(0, 0, 1);
+
+    std::vector<ScreenTriangle> triangles;
+    for (const auto& model : models) {
+        QMatrix4x4 mvp = viewProjection * model.getMatrix();
+        QMatrix3x3 normalMatrix = model.getMatrix().normalMatrix();
+        const auto& vertices = model.getVertices();
+        const auto& normals = model.getNormals();
+        const auto& packs = model.getIndexPacks();
+
+        std::vector<ClipVertex> clip(vertices.size());
+        parallel::forRange(vertices.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                QVector4D p = mvp * QVector4D(vertices.x()[i], vertices.y()[i], vertices.z()[i], 1.0f);
+                clip[i].position = {p.x(), p.y(), p.z()};
+                clip[i].w = p.w();
+            }
+        });
+        std::vector<Vec3<float>> worldNormals(normals.size());
+        for (size_t i = 0; i < normals.size(); ++i)
+            worldNormals[i] = transformNormal(normalMatrix, normals[i]);
+
+        // every input triangle owns two slots, near plane clipping fills at most both
+        size_t count = packs.size() / 3;
+        std::vector<std::vector<ScreenTriangle>> blocks;
+        std::vector<size_t> blockStarts;
+        size_t blockSize = 4096;
+        for (size_t b = 0; b < count; b += blockSize)
+            blockStarts.push_back(b);
+        blocks.resize(blockStarts.size());
+        parallel::forRange(blockStarts.size(), [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; ++b) {
+                size_t last = std::min(count, blockStarts[b] + blockSize);
+                for (size_t t = blockStarts[b]; t < last; ++t) {
+                    ClipVertex corners[3];
+                    bool valid = true;
+                    for (int k = 0; k < 3; ++k) {
+                        const IndexPack& pack = packs[3 * t + k];
+                        if (pack.vertex >= clip.size()) {
+                            valid = false;
+                            break;
+                        }
+                        corners[k] = clip[pack.vertex];
+                        corners[k].normal = pack.normal && *pack.normal < worldNormals.size()
+                                                ? worldNormals[*pack.normal]
+                                                : Vec3<float>(0, 0, 0);
+                    }
+                    if (!valid)
+                        continue;
+                    // corners without a normal take the face normal
+                    Vec3<float> face = transformNormal(normalMatrix, geometry::getNormal(vertices[packs[3 * t].vertex],
+                                                                                          vertices[packs[3 * t + 1].vertex],
+                                                                                          vertices[packs[3 * t + 2].vertex]));
+                    for (auto& corner : corners) {
+                        if (corner.normal.lengthSquared() == 0)
+                            corner.normal = face;
+                    }
+                    setup(corners, model.getColor(), blocks[b]);
+                }
+            }
+        }, 1, _options.threads);
+        for (auto& block : blocks)
+            triangles.insert(triangles.end(), block.begin(), block.end());
+    }
+
+    int tileSize = _options.tileSize;
+    int tilesX = (width + tileSize - 1) / tileSize, tilesY = (height + tileSize - 1) / tileSize;
+    std::vector<std::vector<uint32_t>> bins(static_cast<size_t>(tilesX) * tilesY);
+    for (size_t t = 0; t < triangles.size(); ++t) {
+        const ScreenTriangle& tri = triangles[t];
+        for (int ty = tri.minY / tileSize; ty <= tri.maxY / tileSize; ++ty) {
+            for (int tx = tri.minX / tileSize; tx <= tri.maxX / tileSize; ++tx)
+                bins[static_cast<size_t>(ty) * tilesX + tx].push_back(static_cast<uint32_t>(t));
+        }
+    }
+
+    std::vector<uint32_t> color(static_cast<size_t>(width) * height, packColor(_options.background));
+    std::vector<float> depth(color.size(), std::numeric_limits<float>::infinity());
+    parallel::forRange(bins.size(), [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; ++b)
+            rasterize(triangles, bins[b], static_cast<int>(b % tilesX), static_cast<int>(b / tilesX), light, color, depth);
+    }, 1, _options.threads);
+
+    QImage image(width, height, QImage::Format_RGB32);
+    for (int y = 0; y < height; ++y)
+        std::memcpy(image.scanLine(y), color.data() + static_cast<size_t>(y) * width, static_cast<size_t>(width) * sizeof(uint32_t));
+    return image;
+}
+
+void SoftwareRenderer::setup(const ClipVertex (&corners)[3], const Vec3<float>& color,
+                             std::vector<ScreenTriangle>& triangles) const {
+    // Sutherland-Hodgman against z > -w, the only plane that can make w vanish
+    ClipVertex polygon[4];
+    int count = 0;
+    for (int i = 0; i < 3; ++i) {
+        const ClipVertex& a = corners[i];
+        const ClipVertex& b = corners[(i + 1) % 3];
+        float da = a.position.z + a.w, db = b.position.z + b.w;
+        if (da >= 0)
+            polygon[count++] = a;
+        if ((da >= 0) != (db >= 0)) {
+            float t = da / (da - db);
+            ClipVertex& v = polygon[count++];
+            v.position = a.position + t * (b.position - a.position);
+            v.w = a.w + t * (b.w - a.w);
+            v.normal = a.normal + t * (b.normal - a.normal);
+        }
+    }
+    for (int fan = 2; fan < count; ++fan) {
+        const ClipVertex* v[3] = {&polygon[0], &polygon[fan - 1], &polygon[fan]};
+        ScreenTriangle tri;
+        float minX = std::numeric_limits<float>::max(), minY = minX;
+        float maxX = std::numeric_limits<float>::lowest(), maxY = maxX;
+        for (int k = 0; k < 3; ++k) {
+            float w = std::max(v[k]->w, std::numeric_limits<float>::min());
+            tri.inverseW[k] = 1 / w;
+            tri.x[k] = (v[k]->position.x / w * 0.5f + 0.5f) * _options.width;
+            tri.y[k] = (0.5f - v[k]->position.y / w * 0.5f) * _options.height;
+            tri.depth[k] = v[k]->position.z / w;
+            tri.normal[k] = v[k]->normal * tri.inverseW[k];
+            minX = std::min(minX, tri.x[k]);
+            maxX = std::max(maxX, tri.x[k]);
+            minY = std::min(minY, tri.y[k]);
+            maxY = std::max(maxY, tri.y[k]);
+        }
+        // pixel centers at +0.5, clamped to the image
+        tri.minX = static_cast<int>(std::max(0.0f, std::ceil(minX - 0.5f)));
+        tri.minY = static_cast<int>(std::max(0.0f, std::ceil(minY - 0.5f)));
+        tri.maxX = static_cast<int>(std::min(static_cast<float>(_options.width - 1), std::floor(maxX - 0.5f)));
+        tri.maxY = static_cast<int>(std::min(static_cast<float>(_options.height - 1), std::floor(maxY - 0.5f)));
+        if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+            continue;
+        float area = edge(tri.x[0], tri.y[0], tri.x[1], tri.y[1], tri.x[2], tri.y[2]);
+        if (area == 0 || !std::isfinite(area))
+            continue;
+        // both windings are drawn, as with culling disabled
+        if (area < 0) {
+            std::swap(tri.x[1], tri.x[2]);
+            std::swap(tri.y[1], tri.y[2]);
+            std::swap(tri.depth[1], tri.depth[2]);
+            std::swap(tri.inverseW[1], tri.inverseW[2]);
+            std::swap(tri.normal[1], tri.normal[2]);
+        }
+        tri.color = color;
+        triangles.push_back(tri);
+    }
+}
+
+void SoftwareRenderer::rasterize(const std::vector<ScreenTriangle>& triangles, const std::vector<uint32_t>& bin,
+                                 int tileX, int tileY, const Vec3<float>& light,
+                                 std::vector<uint32_t>& color, std::vector<float>& depth) const {
+    int tileSize = _options.tileSize;
+    int x0 = tileX * tileSize, y0 = tileY * tileSize;
+    int x1 = std::min(_options.width - 1, x0 + tileSize - 1), y1 = std::min(_options.height - 1, y0 + tileSize - 1);
+    for (uint32_t index : bin) {
+        const ScreenTriangle& tri = triangles[index];
+        int minX = std::max(x0, tri.minX), maxX = std::min(x1, tri.maxX);
+        int minY = std::max(y0, tri.minY), maxY = std::min(y1, tri.maxY);
+        float area = edge(tri.x[0], tri.y[0], tri.x[1], tri.y[1], tri.x[2], tri.y[2]);
+        float inverseArea = 1 / area;
+        for (int y = minY; y <= maxY; ++y) {
+            float py = y + 0.5f;
+            for (int x = minX; x <= maxX; ++x) {
+                float px = x + 0.5f;
+                float l0 = edge(tri.x[1], tri.y[1], tri.x[2], tri.y[2], px, py);
+                float l1 = edge(tri.x[2], tri.y[2], tri.x[0], tri.y[0], px, py);
+                float l2 = edge(tri.x[0], tri.y[0], tri.x[1], tri.y[1], px, py);
+                if (l0 < 0 || l1 < 0 || l2 < 0)
+                    continue;
+                l0 *= inverseArea;
+                l1 *= inverseArea;
+                l2 *= inverseArea;
+                float z = l0 * tri.depth[0] + l1 * tri.depth[1] + l2 * tri.depth[2];
+                size_t pixel = static_cast<size_t>(y) * _options.width + x;
+                if (z > 1 || z >= depth[pixel])
+                    continue;
+                depth[pixel] = z;
+                // the 1 / w factor of the perspective correction cancels in the normalization
+                Vec3<float> n = l0 * tri.normal[0] + l1 * tri.normal[1] + l2 * tri.normal[2];
+                float length = n.length();
+                float diffuse = length > 0 ? std::abs(geometry::dot(light, n)) / length : 0;
+                color[pixel] = packColor(tri.color + diffuse * Vec3<float>(0.2f, 0.2f, 0.2f));
+            }
+        }
+    }
+}
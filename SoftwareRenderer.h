@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <QImage>
+#include <QMatrix4x4>
+
+#include "Model.h"
+#include "Camera.h"
+#include "Geometry.h"
+
+// Offscreen rasterizer for machines without a GL context. It draws models the
+// way main.vert and main.frag do: per-vertex normals, base color plus
+// abs(N.L) * 0.2 with the light toward the eye, no culling. Triangles are
+// binned into screen tiles and the tiles are filled in parallel, each with its
+// own part of the color and depth buffers.
+class SoftwareRenderer {
+public:
+    struct Options {
+        int width = 256;
+        int height = 256;
+        float fieldOfView = 60.0f;
+        int tileSize = 32;
+        // 0 uses every core, 1 keeps the whole image on the calling thread
+        unsigned int threads = 0;
+        geometry::Vec3<float> background = {0.2f, 0.2f, 0.2f};
+    };
+
+    explicit SoftwareRenderer(const Options& options);
+
+    QImage render(const std::vector<Model>& models, const Camera& camera) const;
+    // the default camera moved to frame the bounding sphere of the models
+    Camera frame(const std::vector<Model>& models) const;
+
+private:
+    // clip space position with its world space normal
+    struct ClipVertex {
+        geometry::Vec3<float> position;
+        float w;
+        geometry::Vec3<float> normal;
+    };
+
+    // screen space triangle, normals are divided by w for perspective correct interpolation
+    struct ScreenTriangle {
+        float x[3];
+        float y[3];
+        float depth[3];
+        float inverseW[3];
+        geometry::Vec3<float> normal[3];
+        geometry::Vec3<float> color;
+        int minX, minY, maxX, maxY;
+    };
+
+    // clips against the near plane and appends up to two screen triangles
+    void setup(const ClipVertex (&corners)[3], const geometry::Vec3<float>& color,
+               std::vector<ScreenTriangle>& triangles) const;
+    void rasterize(const std::vector<ScreenTriangle>& triangles, const std::vector<uint32_t>& bin,
+                   int tileX, int tileY, const geometry::Vec3<float>& light,
+                   std::vector<uint32_t>& color, std::vector<float>& depth) const;
+
+    Options _options;
+};
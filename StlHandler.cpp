@@ -0,0 +1,88 @@
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <limits>
+
+#include <QOpenGLShaderProgram>
+
+#include "StlHandler.h"
+#include "Model.h"
+#include "Geometry.h"
+#include "remesher/storage.hpp"
+#include "remesher/parallel.hpp"
+#include "remesher/mesh_weld.hpp"
+#include "remesher/mesh_normals.hpp"
+
+static_assert(sizeof(geometry::Vec3<float>) == 3 * sizeof(float), "positions are copied as packed floats");
+
+std::vector<Model> StlHandler::loadStl(const std::string& filepath, QOpenGLShaderProgram& program,
+                                       const LoadOptions& options) {
+    std::vector<Model> models;
+    StlHandler::loadStl(filepath, program, models, options);
+    return models;
+}
+
+void StlHandler::loadStl(const std::string& filepath,
+                         QOpenGLShaderProgram& program,
+                         std::vector<Model>& models,
+                         const LoadOptions& options) {
+    storage::MappedFile file(filepath);
+    const unsigned char* data = static_cast<const unsigned char*>(file.data());
+    if (file.size() < headerSize)
+        throw std::invalid_argument("truncated STL file");
+    // STL is little endian
+    bool swap = storage::hostIsBigEndian();
+    uint32_t triangles = storage::readRaw<uint32_t>(data + 80, swap);
+    if (file.size() != headerSize + static_cast<size_t>(triangles) * recordSize) {
+        if (std::strncmp(reinterpret_cast<const char*>(data), "solid", 5) == 0)
+            throw std::invalid_argument("ASCII STL is not supported");
+        throw std::invalid_argument("truncated STL file");
+    }
+    if (triangles > std::numeric_limits<unsigned int>::max() / 3)
+        throw std::invalid_argument("too many triangles in STL file");
+
+    models.emplace_back(program);
+    Model& model = models.back();
+    auto& vertices = model.getVertices();
+    auto& normals = model.getNormals();
+    auto& packs = model.getIndexPacks();
+    vertices.resize(3 * static_cast<size_t>(triangles));
+    normals.resize(triangles);
+    packs.assign(vertices.size(), IndexPack(0, 0, 0));
+    // records are 50 bytes and unaligned, normal then three corners then attributes
+    parallel::forRange(triangles, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            const unsigned char* record = data + headerSize + t * recordSize;
+            geometry::Vec3<float> corners[3];
+            if (swap) {
+                auto read = [record](size_t offset) {
+                    return geometry::Vec3<float>(storage::readRaw<float>(record + offset, true),
+                                                 storage::readRaw<float>(record + offset + 4, true),
+                                                 storage::readRaw<float>(record + offset + 8, true));
+                };
+                normals[t] = read(0);
+                for (size_t corner = 0; corner < 3; ++corner)
+                    corners[corner] = read(12 + 12 * corner);
+            } else {
+                std::memcpy(&normals[t], record, sizeof(geometry::Vec3<float>));
+                std::memcpy(corners, record + 12, sizeof(corners));
+            }
+            for (size_t corner = 0; corner < 3; ++corner)
+                vertices.set(3 * t + corner, corners[corner]);
+            // exporters often leave the normal zero, those faces get smooth normals
+            bool hasNormal = normals[t].lengthSquared() > 0;
+            for (size_t corner = 3 * t; corner < 3 * t + 3; ++corner) {
+                packs[corner].vertex = static_cast<unsigned int>(corner);
+                packs[corner].texture.reset();
+                if (hasNormal)
+                    packs[corner].normal = static_cast<unsigned int>(t);
+                else
+                    packs[corner].normal.reset();
+            }
+        }
+    });
+    if (options.weld)
+        mesh_weld::weldVertices(model, options.weldTolerance);
+    mesh_normals::fillMissingNormals(model);
+}
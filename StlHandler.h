@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <QOpenGLShaderProgram>
+
+#include "Model.h"
+#include "LoadOptions.h"
+
+// Binary STL. The file is mapped and the triangle records are copied straight
+// into one model, every triangle with its own three vertices; LoadOptions::weld
+// joins them again.
+class StlHandler {
+public:
+    static std::vector<Model> loadStl(const std::string& filepath, QOpenGLShaderProgram& program,
+                                      const LoadOptions& options = {});
+    static void loadStl(const std::string& filepath,
+                        QOpenGLShaderProgram& program,
+                        std::vector<Model>& models,
+                        const LoadOptions& options = {});
+
+private:
+    static constexpr size_t headerSize = 84;
+    static constexpr size_t recordSize = 50;
+};
@@ -0,0 +1,306 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <new>
+#include <iterator>
+#include <stdexcept>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include "Geometry.h"
+
+namespace geometry {
+
+template <typename T, size_t Alignment = 32>
+struct AlignedAllocator {
+    using value_type = T;
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) { }
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+// Positions kept as three aligned arrays of x, y and z so bulk transforms and
+// reductions run over contiguous floats and vectorize. Elements are read as
+// Vec3 values and written with set(), there is no reference to an element.
+class Vec3Array {
+public:
+    using value_type = Vec3<float>;
+    using Storage = std::vector<float, AlignedAllocator<float>>;
+    // partial results kept by the reductions, one AVX register of floats
+    static constexpr size_t lanes = 8;
+
+    class const_iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Vec3<float>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Vec3<float>;
+
+        const_iterator(const Vec3Array& array, size_t index) : _array(&array), _index(index) { }
+        Vec3<float> operator*() const { return (*_array)[_index]; }
+        const_iterator& operator++() { ++_index; return *this; }
+        const_iterator operator++(int) { const_iterator old = *this; ++_index; return old; }
+        bool operator==(const const_iterator& other) const { return _index == other._index; }
+        bool operator!=(const const_iterator& other) const { return _index != other._index; }
+
+    private:
+        const Vec3Array* _array;
+        size_t _index;
+    };
+
+    Vec3Array() = default;
+    explicit Vec3Array(size_t count) : _x(count), _y(count), _z(count) { }
+    explicit Vec3Array(const std::vector<Vec3<float>>& vertices) {
+        resize(vertices.size());
+        for (size_t i = 0; i < vertices.size(); ++i)
+            set(i, vertices[i]);
+    }
+
+    size_t size() const { return _x.size(); }
+    bool empty() const { return _x.empty(); }
+    void reserve(size_t count) { _x.reserve(count); _y.reserve(count); _z.reserve(count); }
+    void resize(size_t count) { _x.resize(count); _y.resize(count); _z.resize(count); }
+    void clear() { _x.clear(); _y.clear(); _z.clear(); }
+    void push_back(const Vec3<float>& v) { _x.push_back(v.x); _y.push_back(v.y); _z.push_back(v.z); }
+    void swap(Vec3Array& other) { _x.swap(other._x); _y.swap(other._y); _z.swap(other._z); }
+
+    Vec3<float> operator[](size_t i) const { return {_x[i], _y[i], _z[i]}; }
+    Vec3<float> at(size_t i) const {
+        if (i >= size())
+            throw std::out_of_range("vertex index out of range");
+        return (*this)[i];
+    }
+    void set(size_t i, const Vec3<float>& v) { _x[i] = v.x; _y[i] = v.y; _z[i] = v.z; }
+
+    const_iterator begin() const { return {*this, 0}; }
+    const_iterator end() const { return {*this, size()}; }
+
+    float* x() { return _x.data(); }
+    float* y() { return _y.data(); }
+    float* z() { return _z.data(); }
+    const float* x() const { return _x.data(); }
+    const float* y() const { return _y.data(); }
+    const float* z() const { return _z.data(); }
+
+    // interleaved copy for code that wants Vec3 memory, e.g. files and the simplifier
+    std::vector<Vec3<float>> toVector() const {
+        std::vector<Vec3<float>> result(size());
+        for (size_t i = 0; i < size(); ++i)
+            result[i] = (*this)[i];
+        return result;
+    }
+
+    // row major affine matrix, the last column is the translation
+    void transform(const float (&m)[3][4]) {
+        transformArrays(_x.data(), _y.data(), _z.data(), size(), m);
+    }
+
+    // The reductions below keep one partial result per lane so the compiler
+    // may vectorize them without reassociating a single accumulator.
+    Vec3<double> sum() const {
+        double sx[lanes] = {}, sy[lanes] = {}, sz[lanes] = {};
+        const float* x = _x.data(); const float* y = _y.data(); const float* z = _z.data();
+        size_t n = size(), i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            for (size_t l = 0; l < lanes; ++l) {
+                sx[l] += x[i + l];
+                sy[l] += y[i + l];
+                sz[l] += z[i + l];
+            }
+        }
+        for (; i < n; ++i) {
+            sx[0] += x[i];
+            sy[0] += y[i];
+            sz[0] += z[i];
+        }
+        Vec3<double> result(0, 0, 0);
+        for (size_t l = 0; l < lanes; ++l) {
+            result.x += sx[l];
+            result.y += sy[l];
+            result.z += sz[l];
+        }
+        return result;
+    }
+
+    float maxDistanceSquared(const Vec3<float>& center) const {
+        float best[lanes] = {};
+        const float* x = _x.data(); const float* y = _y.data(); const float* z = _z.data();
+        size_t n = size(), i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            for (size_t l = 0; l < lanes; ++l) {
+                float dx = x[i + l] - center.x, dy = y[i + l] - center.y, dz = z[i + l] - center.z;
+                float d = dx * dx + dy * dy + dz * dz;
+                best[l] = d > best[l] ? d : best[l];
+            }
+        }
+        for (; i < n; ++i) {
+            float dx = x[i] - center.x, dy = y[i] - center.y, dz = z[i] - center.z;
+            float d = dx * dx + dy * dy + dz * dz;
+            best[0] = d > best[0] ? d : best[0];
+        }
+        return *std::max_element(best, best + lanes);
+    }
+
+    BoundingBox<float> bounds() const {
+        BoundingBox<float> result;
+        if (empty())
+            return result;
+        float low[3][lanes], high[3][lanes];
+        for (size_t l = 0; l < lanes; ++l) {
+            low[0][l] = high[0][l] = _x[0];
+            low[1][l] = high[1][l] = _y[0];
+            low[2][l] = high[2][l] = _z[0];
+        }
+        const float* axes[3] = {_x.data(), _y.data(), _z.data()};
+        size_t n = size();
+        for (int a = 0; a < 3; ++a) {
+            const float* v = axes[a];
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                for (size_t l = 0; l < lanes; ++l) {
+                    low[a][l] = v[i + l] < low[a][l] ? v[i + l] : low[a][l];
+                    high[a][l] = v[i + l] > high[a][l] ? v[i + l] : high[a][l];
+                }
+            }
+            for (; i < n; ++i) {
+                low[a][0] = v[i] < low[a][0] ? v[i] : low[a][0];
+                high[a][0] = v[i] > high[a][0] ? v[i] : high[a][0];
+            }
+        }
+        result.min = {*std::min_element(low[0], low[0] + lanes), *std::min_element(low[1], low[1] + lanes),
+                      *std::min_element(low[2], low[2] + lanes)};
+        result.max = {*std::max_element(high[0], high[0] + lanes), *std::max_element(high[1], high[1] + lanes),
+                      *std::max_element(high[2], high[2] + lanes)};
+        return result;
+    }
+
+    // The same reductions over the positions as mapped by a row major affine
+    // matrix, transformed inside the loop instead of into a copy.
+    Vec3<double> sum(const float (&m)[3][4]) const {
+        // the map is affine, so the sum of mapped points is the mapped sum
+        Vec3<double> s = sum();
+        double n = static_cast<double>(size());
+        return {m[0][0] * s.x + m[0][1] * s.y + m[0][2] * s.z + n * m[0][3],
+                m[1][0] * s.x + m[1][1] * s.y + m[1][2] * s.z + n * m[1][3],
+                m[2][0] * s.x + m[2][1] * s.y + m[2][2] * s.z + n * m[2][3]};
+    }
+
+    float maxDistanceSquared(const Vec3<float>& center, const float (&m)[3][4]) const {
+        const float m00 = m[0][0], m01 = m[0][1], m02 = m[0][2], m03 = m[0][3] - center.x;
+        const float m10 = m[1][0], m11 = m[1][1], m12 = m[1][2], m13 = m[1][3] - center.y;
+        const float m20 = m[2][0], m21 = m[2][1], m22 = m[2][2], m23 = m[2][3] - center.z;
+        float best[lanes] = {};
+        const float* x = _x.data(); const float* y = _y.data(); const float* z = _z.data();
+        size_t n = size(), i = 0;
+        auto distanceSquared = [&](size_t j) {
+            float dx = m00 * x[j] + m01 * y[j] + m02 * z[j] + m03;
+            float dy = m10 * x[j] + m11 * y[j] + m12 * z[j] + m13;
+            float dz = m20 * x[j] + m21 * y[j] + m22 * z[j] + m23;
+            return dx * dx + dy * dy + dz * dz;
+        };
+        for (; i + lanes <= n; i += lanes) {
+            for (size_t l = 0; l < lanes; ++l) {
+                float d = distanceSquared(i + l);
+                best[l] = d > best[l] ? d : best[l];
+            }
+        }
+        for (; i < n; ++i) {
+            float d = distanceSquared(i);
+            best[0] = d > best[0] ? d : best[0];
+        }
+        return *std::max_element(best, best + lanes);
+    }
+
+    BoundingBox<float> bounds(const float (&m)[3][4]) const {
+        BoundingBox<float> result;
+        if (empty())
+            return result;
+        float low[3][lanes], high[3][lanes];
+        for (int a = 0; a < 3; ++a) {
+            std::fill(low[a], low[a] + lanes, std::numeric_limits<float>::max());
+            std::fill(high[a], high[a] + lanes, -std::numeric_limits<float>::max());
+        }
+        const float* x = _x.data(); const float* y = _y.data(); const float* z = _z.data();
+        size_t n = size();
+        for (int a = 0; a < 3; ++a) {
+            const float ma = m[a][0], mb = m[a][1], mc = m[a][2], md = m[a][3];
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                for (size_t l = 0; l < lanes; ++l) {
+                    float v = ma * x[i + l] + mb * y[i + l] + mc * z[i + l] + md;
+                    low[a][l] = v < low[a][l] ? v : low[a][l];
+                    high[a][l] = v > high[a][l] ? v : high[a][l];
+                }
+            }
+            for (; i < n; ++i) {
+                float v = ma * x[i] + mb * y[i] + mc * z[i] + md;
+                low[a][0] = v < low[a][0] ? v : low[a][0];
+                high[a][0] = v > high[a][0] ? v : high[a][0];
+            }
+        }
+        result.min = {*std::min_element(low[0], low[0] + lanes), *std::min_element(low[1], low[1] + lanes),
+                      *std::min_element(low[2], low[2] + lanes)};
+        result.max = {*std::max_element(high[0], high[0] + lanes), *std::max_element(high[1], high[1] + lanes),
+                      *std::max_element(high[2], high[2] + lanes)};
+        return result;
+    }
+
+private:
+    // the arrays never overlap, restrict lets the compiler vectorize without
+    // checking that at run time
+    static void transformArrays(float* __restrict x, float* __restrict y, float* __restrict z, size_t n,
+                                const float (&matrix)[3][4]) {
+        const float m00 = matrix[0][0], m01 = matrix[0][1], m02 = matrix[0][2], m03 = matrix[0][3];
+        const float m10 = matrix[1][0], m11 = matrix[1][1], m12 = matrix[1][2], m13 = matrix[1][3];
+        const float m20 = matrix[2][0], m21 = matrix[2][1], m22 = matrix[2][2], m23 = matrix[2][3];
+        for (size_t i = 0; i < n; ++i) {
+            float vx = x[i], vy = y[i], vz = z[i];
+            x[i] = m00 * vx + m01 * vy + m02 * vz + m03;
+            y[i] = m10 * vx + m11 * vy + m12 * vz + m13;
+            z[i] = m20 * vx + m21 * vy + m22 * vz + m23;
+        }
+    }
+
+    Storage _x;
+    Storage _y;
+    Storage _z;
+};
+
+inline void swap(Vec3Array& first, Vec3Array& second) {
+    first.swap(second);
+}
+
+// batch versions of the Container templates in Geometry.h
+inline Vec3<float> getCentroid(const Vec3Array& vertices) {
+    if (vertices.empty())
+        return {0, 0, 0};
+    Vec3<double> sum = vertices.sum();
+    double n = static_cast<double>(vertices.size());
+    return {static_cast<float>(sum.x / n), static_cast<float>(sum.y / n), static_cast<float>(sum.z / n)};
+}
+
+inline float getRadius(const Vec3<float>& center, const Vec3Array& vertices) {
+    return std::sqrt(vertices.maxDistanceSquared(center));
+}
+
+inline float getRadius(const Vec3Array& vertices) {
+    return getRadius(getCentroid(vertices), vertices);
+}
+
+} // namespace geometry
@@ -1,6 +1,9 @@
 #include <memory>
 #include <string>
 #include <cstdlib>
+#include <cmath>
+#include <future>
+#include <chrono>
 
 #include <QString>
 #include <QOpenGLFunctions>
@@ -10,30 +13,52 @@
 #include <QMatrix4x4>
 #include <QVector3D>
 #include <QQuaternion>
+#include <QtMath>
+#include <QPainter>
+#include <QTimer>
 #include <iostream>
 
 
 #include "Window.h"
-#include "ObjHandler.h"
+#include "SceneLoader.h"
 #include "Model.h"
+#include "Frustum.h"
+#include "RemeshJob.h"
 #include "Meshes.hpp"
 #include "remesher/projection_remesher.hpp"
 
+// how often running remesh and level of detail jobs are checked
+static constexpr int backgroundPollInterval = 30;
+static constexpr float fieldOfView = 60.0f;
+
 Window::Window(QWidget* parent) 
-    : QOpenGLWidget(parent) { }
+    : QOpenGLWidget(parent) {
+    connect(&_backgroundTimer, SIGNAL(timeout()), this, SLOT(pollBackgroundWork()));
+}
+
+Window::~Window() {
+    makeCurrent();
+    _profiler.destroy();
+}
 
 void Window::initializeGL() {
     initializeOpenGLFunctions();
-    connect(this, SIGNAL(frameSwapped()), this, SLOT(update()));
+    _profiler.initialize();
 
     compileShaderProgram("shaders/main.vert", "shaders/main.frag");
+    _sceneBatch = std::make_unique<SceneBatch>(*_program);
 
-    addModels("res/apple.obj");
+    size_t firstModel = _models.size();
+    SceneLoader::load("res/apple.obj", *_program, _models);
+    // the remesh copy is taken before the level of detail build expands the models
     std::vector<Model> parts = _models;
+    buildLods(firstModel);
+    _sceneChanged = true;
     _models.back().setColor({0.5,0.1,0.2});
     _models.pop_back();
     // _models.back().uniformScale(0.98);
-    _models.push_back(projection_remesher::remesh(parts, IcoSphere().get(*_program, 1, 3)));
+    _remeshJob = std::make_unique<RemeshJob>(parts, IcoSphere().get(*_program, 1, 3));
+    _backgroundTimer.start(backgroundPollInterval);
     std::cout<<"bezim"<<std::endl;
     _modelMatrix.setToIdentity();
 
@@ -46,34 +71,127 @@ void Window::resizeGL(int width, int height) {
     _projection.setToIdentity();
 
     float aspect = width / (float)height;
-    _projection.perspective(60.0f, aspect, 0.1f, 1000.0f);
+    _projection.perspective(fieldOfView, aspect, 0.1f, 1000.0f);
 }
 
 void Window::paintGL() {
+    _profiler.beginFrame();
+    // the overlay painter does not restore GL state
+    glEnable(GL_DEPTH_TEST);
     glClear(GL_COLOR_BUFFER_BIT);
     glClear(GL_DEPTH_BUFFER_BIT); 
     
+    QMatrix4x4 viewProjection = _projection * _camera.getMatrix() * _modelMatrix;
+    Frustum frustum(viewProjection);
     _program->bind();
-    _program->setUniformValue("MVPmatrix", _projection * _camera.getMatrix()  * _modelMatrix);
+    _program->setUniformValue("MVPmatrix", viewProjection);
     _program->setUniformValue("light_position", _camera.getEye().x(),
                                                  _camera.getEye().y(),
                                                  _camera.getEye().z());
     _program->release();
 
-    for (Model& model : _models) {
-        model.draw();
+    if (_sceneChanged) {
+        _sceneBatch->build(_models);
+        _sceneChanged = false;
     }
-    
+    LodSelector lod;
+    lod.eye = _camera.getEye();
+    lod.pixelsPerUnit = height() / (2 * std::tan(qDegreesToRadians(fieldOfView) / 2));
+
+    _sceneBatch->draw(&_profiler.getStats(), &frustum, &lod);
+    if (_remeshJob) {
+        _remeshJob->getResult().draw(&_profiler.getStats(), &frustum);
+    }
+    _profiler.endFrame();
+
+    if (_showOverlay)
+        drawOverlay();
+}
+
+void Window::drawOverlay() {
+    const RenderStats& stats = _profiler.getLastStats();
+    QString text = QString("CPU %1 ms\nGPU %2 ms (previous frame)\ndraw calls %3\ntriangles %4")
+        .arg(_profiler.getCpuMilliseconds(), 0, 'f', 2)
+        .arg(_profiler.getGpuMilliseconds(), 0, 'f', 2)
+        .arg(stats.drawCalls)
+        .arg(static_cast<qulonglong>(stats.triangles));
+    if (_remeshJob && !_remeshJob->finished())
+        text += QString("\nremesh %1 %").arg(_remeshJob->getProgress() * 100, 0, 'f', 1);
+
+    QPainter painter(this);
+    QRect bounds = painter.boundingRect(QRect(10, 10, width(), height()), Qt::AlignLeft | Qt::AlignTop, text);
+    painter.fillRect(bounds.adjusted(-5, -5, 5, 5), QColor(0, 0, 0, 160));
+    painter.setPen(Qt::white);
+    painter.drawText(bounds, Qt::AlignLeft | Qt::AlignTop, text);
 }
 
 void Window::addModels(const std::string& filepath) {
-    ObjHandler::loadObj(filepath, *_program, _models);
+    size_t firstModel = _models.size();
+    SceneLoader::load(filepath, *_program, _models);
+    buildLods(firstModel);
+    _sceneChanged = true;
+    update();
+}
+
+void Window::buildLods(size_t firstModel) {
+    using Geometry = std::pair<std::vector<geometry::Vec3<float>>, std::vector<unsigned int>>;
+    std::vector<Geometry> geometry;
+    LodJob job;
+    job.firstModel = firstModel;
+    for (size_t i = firstModel; i < _models.size(); ++i) {
+        _models[i].makeIndices();
+        geometry.emplace_back(_models[i].getVertices().toVector(), _models[i].getIndices());
+        job.vertexCounts.push_back(_models[i].getVertices().size());
+    }
+    job.levels = std::async(std::launch::async, [geometry = std::move(geometry)]() {
+        std::vector<std::vector<mesh_simplifier::Level>> levels;
+        for (const auto& g : geometry) {
+            levels.push_back(mesh_simplifier::buildLodChain(g.first, g.second));
+        }
+        return levels;
+    });
+    _lodJobs.push_back(std::move(job));
+    _backgroundTimer.start(backgroundPollInterval);
+}
+
+bool Window::pollLods() {
+    bool installed = false;
+    for (auto job = _lodJobs.begin(); job != _lodJobs.end();) {
+        if (job->levels.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++job;
+            continue;
+        }
+        auto levels = job->levels.get();
+        for (size_t i = 0; i < levels.size(); ++i) {
+            size_t model = job->firstModel + i;
+            // models removed meanwhile are skipped
+            if (model < _models.size() && _models[model].getVertices().size() == job->vertexCounts[i])
+                _models[model].setLods(levels[i]);
+        }
+        job = _lodJobs.erase(job);
+        installed = true;
+    }
+    return installed;
 }
 
 void Window::update() {
     QOpenGLWidget::update();
 }
 
+void Window::pollBackgroundWork() {
+    bool changed = false;
+    if (_remeshJob)
+        changed |= _remeshJob->poll();
+    if (pollLods()) {
+        _sceneChanged = true;
+        changed = true;
+    }
+    if (changed)
+        update();
+    if ((!_remeshJob || _remeshJob->finished()) && _lodJobs.empty())
+        _backgroundTimer.stop();
+}
+
 
 
 void Window::wheelEvent(QWheelEvent* event) {
@@ -101,6 +219,15 @@ void Window::mouseMoveEvent(QMouseEvent* event) {
 }
 
 
+void Window::keyPressEvent(QKeyEvent* event) {
+    if (event->key() != Qt::Key_F3) {
+        QOpenGLWidget::keyPressEvent(event);
+        return;
+    }
+    _showOverlay = !_showOverlay;
+    update();
+}
+
 void Window::compileShaderProgram(const QString& vertexFilepath, const QString& fragmentFilepath) {
     _program = std::make_unique<QOpenGLShaderProgram>(this);
     _program->addShaderFromSourceFile(QOpenGLShader::Vertex, vertexFilepath);
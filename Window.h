@@ -2,6 +2,8 @@
 
 #include <memory>
 #include <string>
+#include <vector>
+#include <future>
 #include <QString>
 #include <QOpenGLWidget>
 #include <QOpenGLFunctions>
@@ -10,17 +12,24 @@
 #include <QOpenGLShaderProgram>
 #include <QMatrix4x4>
 #include <QWheelEvent>
+#include <QKeyEvent>
 #include <QPoint>
+#include <QTimer>
 
 #include "Model.h"
 #include "Camera.h"
+#include "RemeshJob.h"
+#include "SceneBatch.h"
+#include "FrameProfiler.h"
+#include "LodSelector.h"
+#include "remesher/mesh_simplifier.hpp"
 
 class Window : public QOpenGLWidget, protected QOpenGLFunctions {
     Q_OBJECT
 
 public:
     Window(QWidget* parent = nullptr);
-    ~Window() { makeCurrent(); }
+    ~Window();
     void initializeGL() override;
     void resizeGL(int width, int height) override;
     void paintGL() override;
@@ -28,17 +37,37 @@ public:
 
 protected slots:
     void update();
+    void pollBackgroundWork();
 
 protected:
     void wheelEvent(QWheelEvent* event) override;
     void mousePressEvent(QMouseEvent* event) override;
     void mouseMoveEvent(QMouseEvent* event) override;
+    void keyPressEvent(QKeyEvent* event) override;
 
 private:
     void compileShaderProgram(const QString& vertexFilepath, const QString& fragmentFilePath);
+    void drawOverlay();
+    void buildLods(size_t firstModel);
+    bool pollLods();
+
+    // simplified levels of models [firstModel, firstModel + levels.size())
+    struct LodJob {
+        size_t firstModel;
+        std::vector<size_t> vertexCounts;
+        std::future<std::vector<std::vector<mesh_simplifier::Level>>> levels;
+    };
     
     std::unique_ptr<QOpenGLShaderProgram> _program;
     std::vector<Model> _models;
+    std::unique_ptr<SceneBatch> _sceneBatch;
+    bool _sceneChanged = true;
+    std::unique_ptr<RemeshJob> _remeshJob;
+    std::vector<LodJob> _lodJobs;
+    QTimer _backgroundTimer;
+
+    FrameProfiler _profiler;
+    bool _showOverlay = false;
 
     Camera _camera;
     QMatrix4x4 _projection;
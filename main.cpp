@@ -1,18 +1,263 @@
 #include <QApplication>
+#include <QCoreApplication>
+#include <QStringList>
+#include <QFileInfo>
+#include <QDir>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
 #include <memory>
+#include <mutex>
 
 #include "Window.h"
 #include "MainWindow.h"
+#include "RemeshServer.h"
+#include "ShardedRemesh.h"
+#include "ObjHandler.h"
+#include "SceneLoader.h"
+#include "RemeshArchive.h"
+#include "SoftwareRenderer.h"
+#include "Meshes.hpp"
+#include "remesher/surface_error.hpp"
+#include "remesher/remesh_session.hpp"
+#include "remesher/parallel.hpp"
 
+// remesher --serve [name] [--cache directory] [--scenes count]
+static int serve(int argc, char **argv) {
+    QCoreApplication application(argc, argv);
+    QStringList arguments = application.arguments();
+    auto valueAfter = [&arguments](const QString& option, const QString& fallback) {
+        int at = arguments.indexOf(option);
+        if (at < 0 || at + 1 >= arguments.size() || arguments[at + 1].startsWith("--"))
+            return fallback;
+        return arguments[at + 1];
+    };
+    QString name = valueAfter("--serve", "remesher");
+    std::string cache = valueAfter("--cache", "").toStdString();
+    size_t scenes = valueAfter("--scenes", "4").toUInt();
+
+    RemeshServer server(scenes == 0 ? 1 : scenes, cache);
+    if (!server.listen(name)) {
+        std::cerr << "cannot listen on " << name.toStdString() << ": " << server.errorString().toStdString() << std::endl;
+        return 1;
+    }
+    return application.exec();
+}
+
+// nearest surface point through a distance field, in this process
+static Model projectClosest(const std::vector<Model>& scene, const Model& primitive, const std::string& cacheDirectory,
+                            projection_remesher::PreparedScene& prepared) {
+    projection_remesher::RemeshOptions options;
+    options.projection = projection_remesher::Projection::ClosestPoint;
+    options.cacheDirectory = cacheDirectory;
+    projection_remesher::RemeshStats stats;
+    prepared = projection_remesher::prepareScene(scene, options);
+    Model result = projection_remesher::project(prepared, primitive, options, &stats);
+    std::cout << "field fallbacks " << stats.fallbackVertices << std::endl;
+    return result;
+}
+
+// remesher --sharded scene out.obj|out.prm [--level n] [--workers n] [--primitive type] [--work directory] [--closest] [--evaluate]
+static int sharded(int argc, char **argv) {
+    QCoreApplication application(argc, argv);
+    QStringList arguments = application.arguments();
+    int at = arguments.indexOf("--sharded");
+    if (at + 2 >= arguments.size()) {
+        std::cerr << "usage: --sharded scene out.obj|out.prm [--level n] [--workers n] [--primitive type] [--work directory] [--closest] [--evaluate]" << std::endl;
+        return 1;
+    }
+    auto valueAfter = [&arguments](const QString& option, const QString& fallback) {
+        int at = arguments.indexOf(option);
+        return at < 0 || at + 1 >= arguments.size() ? fallback : arguments[at + 1];
+    };
+    ShardedRemesh::Options options;
+    options.workers = valueAfter("--workers", "4").toUInt();
+    options.workDirectory = valueAfter("--work", ".").toStdString();
+    unsigned int level = valueAfter("--level", "3").toUInt();
+    try {
+        QOpenGLShaderProgram program;
+        LoadOptions load;
+        load.weld = true;
+        std::vector<Model> scene = SceneLoader::load(arguments[at + 1].toStdString(), program, load);
+        RemeshArchive::Source source;
+        source.primitive = valueAfter("--primitive", "icosphere") == "cubesphere" ? RemeshArchive::Primitive::CubeSphere
+                                                                                 : RemeshArchive::Primitive::IcoSphere;
+        source.level = level;
+        Model primitive = RemeshArchive::makePrimitive(source.primitive, level, program);
+        // keeps the hierarchy the run used, so --evaluate does not build another
+        projection_remesher::PreparedScene prepared;
+        Model result = arguments.contains("--closest") ? projectClosest(scene, primitive, options.workDirectory, prepared)
+                                                       : ShardedRemesh::run(scene, primitive, options, &prepared);
+        std::string output = arguments[at + 2].toStdString();
+        if (output.size() > 4 && output.compare(output.size() - 4, 4, ".prm") == 0) {
+            // the archive rebuilds the primitive on the sphere run fitted it to
+            source.center = prepared.center;
+            source.radius = prepared.radius;
+            RemeshArchive::save(output, result, source, RemeshArchive::Options());
+        } else {
+            ObjHandler::saveObj(result, output);
+        }
+        if (arguments.contains("--evaluate")) {
+            surface_error::Report report = surface_error::evaluate(prepared, result);
+            std::cout << "hausdorff " << report.hausdorff << " of diagonal " << report.diagonal << '\n'
+                      << "to scene max " << report.forward.max << " mean " << report.forward.mean << " rms " << report.forward.rms << '\n'
+                      << "to result max " << report.backward.max << " mean " << report.backward.mean << " rms " << report.backward.rms << '\n'
+                      << "vertices at center " << report.centerVertices << '\n'
+                      << "vertices off the surface " << report.forward.offSurface << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// remesher --chunked scene.obj work out.obj [--level n] [--primitive type] [--budget megabytes]
+static int chunked(int argc, char **argv) {
+    QCoreApplication application(argc, argv);
+    QStringList arguments = application.arguments();
+    int at = arguments.indexOf("--chunked");
+    if (at + 3 >= arguments.size()) {
+        std::cerr << "usage: --chunked scene.obj work out.obj [--level n] [--primitive type] [--budget megabytes]" << std::endl;
+        return 1;
+    }
+    auto valueAfter = [&arguments](const QString& option, const QString& fallback) {
+        int at = arguments.indexOf(option);
+        return at < 0 || at + 1 >= arguments.size() ? fallback : arguments[at + 1];
+    };
+    unsigned int level = valueAfter("--level", "3").toUInt();
+    try {
+        chunked_scene::BuildOptions build;
+        build.memoryBudget = static_cast<size_t>(valueAfter("--budget", "1024").toULongLong()) << 20;
+        if (!QDir().mkpath(arguments[at + 2]))
+            throw std::runtime_error("cannot create " + arguments[at + 2].toStdString());
+        // the scene is streamed into chunks on disk and never loaded whole
+        chunked_scene::ChunkedScene scene = chunked_scene::ChunkedScene::build(arguments[at + 1].toStdString(),
+                                                                               arguments[at + 2].toStdString(), build);
+        QOpenGLShaderProgram program;
+        RemeshArchive::Primitive type = valueAfter("--primitive", "icosphere") == "cubesphere" ? RemeshArchive::Primitive::CubeSphere
+                                                                                               : RemeshArchive::Primitive::IcoSphere;
+        Model result = projection_remesher::remesh(scene, RemeshArchive::makePrimitive(type, level, program));
+        ObjHandler::saveObj(result, arguments[at + 3].toStdString());
+        std::cout << "triangles " << scene.getTriangleCount() << " mapped bytes " << scene.getMappedBytes() << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// remesher --session scene out.obj [--add scene]... [--level n] [--primitive type]
+static int session(int argc, char **argv) {
+    QCoreApplication application(argc, argv);
+    QStringList arguments = application.arguments();
+    int at = arguments.indexOf("--session");
+    if (at + 2 >= arguments.size()) {
+        std::cerr << "usage: --session scene out.obj [--add scene]... [--level n] [--primitive type]" << std::endl;
+        return 1;
+    }
+    auto valueAfter = [&arguments](const QString& option, const QString& fallback) {
+        int at = arguments.indexOf(option);
+        return at < 0 || at + 1 >= arguments.size() ? fallback : arguments[at + 1];
+    };
+    unsigned int level = valueAfter("--level", "3").toUInt();
+    try {
+        QOpenGLShaderProgram program;
+        std::vector<Model> scene = SceneLoader::load(arguments[at + 1].toStdString(), program);
+        RemeshArchive::Primitive type = valueAfter("--primitive", "icosphere") == "cubesphere" ? RemeshArchive::Primitive::CubeSphere
+                                                                                               : RemeshArchive::Primitive::IcoSphere;
+        // the sphere is fitted to the first scene, added models only show where they are inside it
+        remesh_session::Session remesh(scene, RemeshArchive::makePrimitive(type, level, program));
+        for (int i = at + 3; i + 1 < arguments.size(); ++i) {
+            if (arguments[i] != "--add")
+                continue;
+            std::string file = arguments[++i].toStdString();
+            for (const Model& model : SceneLoader::load(file, program)) {
+                remesh_session::UpdateStats stats;
+                remesh.addModel(model, &stats);
+                std::cout << file << ": retraced " << stats.retracedVertices << " moved " << stats.movedVertices << std::endl;
+            }
+        }
+        size_t mismatches = remesh.countMismatches();
+        if (mismatches != 0)
+            throw std::runtime_error(std::to_string(mismatches) + " vertices disagree with a full projection");
+        ObjHandler::saveObj(remesh.getResult(), arguments[at + 2].toStdString());
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// remesher --thumbnails directory [--size n] scene...
+static int thumbnails(int argc, char **argv) {
+    QCoreApplication application(argc, argv);
+    QStringList arguments = application.arguments();
+    int at = arguments.indexOf("--thumbnails");
+    QStringList files;
+    SoftwareRenderer::Options options;
+    for (int i = at + 2; i < arguments.size(); ++i) {
+        if (arguments[i] == "--size" && i + 1 < arguments.size())
+            options.width = options.height = arguments[++i].toInt();
+        else
+            files.append(arguments[i]);
+    }
+    if (at + 1 >= arguments.size() || files.isEmpty() || options.width <= 0) {
+        std::cerr << "usage: --thumbnails directory [--size n] scene..." << std::endl;
+        return 1;
+    }
+    std::string directory = arguments[at + 1].toStdString();
+    // one scene per thread when there are several, otherwise the tiles of the one image
+    if (files.size() > 1)
+        options.threads = 1;
+    SoftwareRenderer renderer(options);
+    std::mutex lock;
+    bool failed = false;
+    parallel::forRange(static_cast<size_t>(files.size()), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const QString& file = files[static_cast<int>(i)];
+            std::string output = directory + "/" + QFileInfo(file).completeBaseName().toStdString() + ".png";
+            try {
+                QOpenGLShaderProgram program;
+                std::vector<Model> scene = SceneLoader::load(file.toStdString(), program);
+                QImage image = renderer.render(scene, renderer.frame(scene));
+                if (!image.save(QString::fromStdString(output)))
+                    throw std::runtime_error("cannot write " + output);
+            } catch (const std::exception& e) {
+                std::lock_guard<std::mutex> guard(lock);
+                std::cerr << file.toStdString() << ": " << e.what() << std::endl;
+                failed = true;
+            }
+        }
+    }, 1);
+    return failed ? 1 : 0;
+}
 
 int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--serve") == 0)
+            return serve(argc, argv);
+        if (std::strcmp(argv[i], "--sharded") == 0)
+            return sharded(argc, argv);
+        if (std::strcmp(argv[i], "--chunked") == 0)
+            return chunked(argc, argv);
+        if (std::strcmp(argv[i], "--session") == 0)
+            return session(argc, argv);
+        if (std::strcmp(argv[i], "--thumbnails") == 0)
+            return thumbnails(argc, argv);
+        if (std::strcmp(argv[i], "--shard-worker") == 0 && i + 2 < argc)
+            return ShardedRemesh::work(argv[i + 1], static_cast<unsigned int>(std::strtoul(argv[i + 2], nullptr, 10)));
+    }
+
     QApplication application(argc, argv);
 
     QSurfaceFormat format;
     format.setRenderableType(QSurfaceFormat::OpenGL);
     format.setProfile(QSurfaceFormat::CoreProfile);
-    format.setSwapInterval(100);
+    format.setSwapInterval(1);
+    format.setDepthBufferSize(24);
     format.setVersion(3, 3);
+    QSurfaceFormat::setDefaultFormat(format);
 
     MainWindow window;
     window.show();
@@ -20,4 +265,4 @@ int main(int argc, char **argv) {
     return application.exec();
 
 
-}
\ No newline at end of file
+}
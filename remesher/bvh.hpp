@@ -0,0 +1,360 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include "../Geometry.h"
+
+// Bounding volume hierarchy over scene triangles. Nodes and triangles are flat
+// POD arrays, so a hierarchy can be written to disk and queried straight from a
+// memory mapped file through a BvhView.
+namespace bvh{
+    using namespace geometry;
+
+    struct Triangle{
+        Vec3<float> a;
+        Vec3<float> b;
+        Vec3<float> c;
+
+        Vec3<float> centroid() const { return (a + b + c) / 3.0f; }
+        BoundingBox<float> bounds() const{
+            BoundingBox<float> box;
+            box.extend(a);
+            box.extend(b);
+            box.extend(c);
+            return box;
+        }
+    };
+
+    // leaves hold count triangles from first, inner nodes have count 0, their
+    // left child directly follows them and the right child is at first
+    struct Node{
+        BoundingBox<float> bounds;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    static_assert(std::is_trivially_copyable<Triangle>::value, "triangles are stored on disk");
+    static_assert(std::is_trivially_copyable<Node>::value, "nodes are stored on disk");
+
+    struct FileHeader{
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t nodeCount;
+        uint64_t triangleCount;
+    };
+
+    constexpr char fileMagic[8] = {'P', 'R', 'B', 'V', 'H', 0, 0, 0};
+    constexpr uint32_t fileVersion = 1;
+
+    // grows a box by a tiny relative margin, so hits the triangle test accepts
+    // just outside a triangle due to rounding are not culled by its bounds
+    inline BoundingBox<float> padded(BoundingBox<float> box){
+        if(box.isEmpty())
+            return box;
+        float magnitude = 0;
+        for(int axis = 0; axis < 3; ++axis){
+            magnitude = std::max(magnitude, std::abs((&box.min.x)[axis]));
+            magnitude = std::max(magnitude, std::abs((&box.max.x)[axis]));
+        }
+        float margin = magnitude * 1e-5f + std::numeric_limits<float>::min();
+        box.min -= {margin, margin, margin};
+        box.max += {margin, margin, margin};
+        return box;
+    }
+
+    // slab test of the segment origin + t * direction, t in [0, tMax]
+    inline bool intersectsBox(const BoundingBox<float>& box, const Vec3<float>& origin,
+                              const Vec3<float>& inverseDirection, float tMax, float& tEntry){
+        float t0 = 0, t1 = tMax;
+        const float* lo = &box.min.x;
+        const float* hi = &box.max.x;
+        const float* o = &origin.x;
+        const float* inv = &inverseDirection.x;
+        for(int axis = 0; axis < 3; ++axis){
+            float near = (lo[axis] - o[axis]) * inv[axis];
+            float far = (hi[axis] - o[axis]) * inv[axis];
+            if(near > far)
+                std::swap(near, far);
+            // 0 * inf from a flat direction inside the slab is not a miss
+            if(near != near) near = 0;
+            if(far != far) far = tMax;
+            t0 = std::max(t0, near);
+            t1 = std::min(t1, far);
+            if(t0 > t1)
+                return false;
+        }
+        tEntry = t0;
+        return true;
+    }
+
+    // Moller-Trumbore, both sides of the triangle are hit
+    inline bool intersectTriangle(const Triangle& tri, const Vec3<float>& origin,
+                                  const Vec3<float>& direction, float tMax, float& t){
+        Vec3<float> e1 = tri.b - tri.a;
+        Vec3<float> e2 = tri.c - tri.a;
+        Vec3<float> p = cross(direction, e2);
+        float det = dot(e1, p);
+        if(det == 0)
+            return false;
+        float invDet = 1.0f / det;
+        Vec3<float> s = origin - tri.a;
+        float u = dot(s, p) * invDet;
+        if(u < 0 || u > 1)
+            return false;
+        Vec3<float> q = cross(s, e1);
+        float v = dot(direction, q) * invDet;
+        if(v < 0 || u + v > 1)
+            return false;
+        float hit = dot(e2, q) * invDet;
+        if(hit < 0 || hit > tMax)
+            return false;
+        t = hit;
+        return true;
+    }
+
+    // closest point of the triangle to p, Ericson's region test
+    inline Vec3<float> closestPointOnTriangle(const Triangle& tri, const Vec3<float>& p){
+        Vec3<float> ab = tri.b - tri.a, ac = tri.c - tri.a, ap = p - tri.a;
+        float d1 = dot(ab, ap), d2 = dot(ac, ap);
+        if(d1 <= 0 && d2 <= 0)
+            return tri.a;
+        Vec3<float> bp = p - tri.b;
+        float d3 = dot(ab, bp), d4 = dot(ac, bp);
+        if(d3 >= 0 && d4 <= d3)
+            return tri.b;
+        float vc = d1 * d4 - d3 * d2;
+        if(vc <= 0 && d1 >= 0 && d3 <= 0)
+            return tri.a + (d1 / (d1 - d3)) * ab;
+        Vec3<float> cp = p - tri.c;
+        float d5 = dot(ab, cp), d6 = dot(ac, cp);
+        if(d6 >= 0 && d5 <= d6)
+            return tri.c;
+        float vb = d5 * d2 - d1 * d6;
+        if(vb <= 0 && d2 >= 0 && d6 <= 0)
+            return tri.a + (d2 / (d2 - d6)) * ac;
+        float va = d3 * d6 - d5 * d4;
+        if(va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+            return tri.b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (tri.c - tri.b);
+        float denominator = 1.0f / (va + vb + vc);
+        return tri.a + (vb * denominator) * ab + (vc * denominator) * ac;
+    }
+
+    inline float distanceSquared(const BoundingBox<float>& box, const Vec3<float>& p){
+        float result = 0;
+        for(int axis = 0; axis < 3; ++axis){
+            float v = (&p.x)[axis];
+            float lo = (&box.min.x)[axis], hi = (&box.max.x)[axis];
+            float d = v < lo ? lo - v : v > hi ? v - hi : 0;
+            result += d * d;
+        }
+        return result;
+    }
+
+    struct BvhView{
+        const Node* nodes = nullptr;
+        size_t nodeCount = 0;
+        const Triangle* triangles = nullptr;
+        size_t triangleCount = 0;
+
+        bool isEmpty() const { return nodeCount == 0; }
+        BoundingBox<float> bounds() const { return isEmpty() ? BoundingBox<float>() : nodes[0].bounds; }
+
+        // nearest hit of origin + t * direction with t in [0, t], t is updated on a hit
+        bool intersect(const Vec3<float>& origin, const Vec3<float>& direction, float& t) const{
+            if(isEmpty())
+                return false;
+            Vec3<float> inverse = {1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z};
+            uint32_t stack[64];
+            int top = 0;
+            stack[top++] = 0;
+            bool hit = false;
+            float entry;
+            while(top > 0){
+                const Node& node = nodes[stack[--top]];
+                if(!intersectsBox(node.bounds, origin, inverse, t, entry))
+                    continue;
+                if(node.count > 0){
+                    for(uint32_t i = node.first; i < node.first + node.count; ++i){
+                        if(intersectTriangle(triangles[i], origin, direction, t, t))
+                            hit = true;
+                    }
+                    continue;
+                }
+                uint32_t left = static_cast<uint32_t>(&node - nodes) + 1;
+                uint32_t right = node.first;
+                // visit the child the segment enters first
+                float leftEntry, rightEntry;
+                bool leftHit = intersectsBox(nodes[left].bounds, origin, inverse, t, leftEntry);
+                bool rightHit = intersectsBox(nodes[right].bounds, origin, inverse, t, rightEntry);
+                if(leftHit && rightHit){
+                    if(leftEntry < rightEntry)
+                        std::swap(left, right);
+                    stack[top++] = left;
+                    stack[top++] = right;
+                }else if(leftHit){
+                    stack[top++] = left;
+                }else if(rightHit){
+                    stack[top++] = right;
+                }
+            }
+            return hit;
+        }
+
+        // nearest surface point to p closer than sqrt(distanceSquared), which
+        // is updated on success together with point and triangle
+        bool closestPoint(const Vec3<float>& p, float& distanceSquared, Vec3<float>& point, uint32_t& triangle) const{
+            if(isEmpty())
+                return false;
+            // nodes wait with their box distance, so they are dropped once a
+            // closer triangle is known without touching their bounds again
+            uint32_t stack[64];
+            float entries[64];
+            int top = 0;
+            stack[top] = 0;
+            entries[top++] = bvh::distanceSquared(nodes[0].bounds, p);
+            bool found = false;
+            while(top > 0){
+                --top;
+                if(entries[top] >= distanceSquared)
+                    continue;
+                const Node& node = nodes[stack[top]];
+                if(node.count > 0){
+                    for(uint32_t i = node.first; i < node.first + node.count; ++i){
+                        Vec3<float> candidate = closestPointOnTriangle(triangles[i], p);
+                        float d = (candidate - p).lengthSquared();
+                        if(d < distanceSquared){
+                            distanceSquared = d;
+                            point = candidate;
+                            triangle = i;
+                            found = true;
+                        }
+                    }
+                    continue;
+                }
+                uint32_t left = static_cast<uint32_t>(&node - nodes) + 1;
+                uint32_t right = node.first;
+                float leftDistance = bvh::distanceSquared(nodes[left].bounds, p);
+                float rightDistance = bvh::distanceSquared(nodes[right].bounds, p);
+                // the nearer child goes on top of the stack
+                if(leftDistance < rightDistance){
+                    std::swap(left, right);
+                    std::swap(leftDistance, rightDistance);
+                }
+                if(leftDistance < distanceSquared){
+                    stack[top] = left;
+                    entries[top++] = leftDistance;
+                }
+                if(rightDistance < distanceSquared){
+                    stack[top] = right;
+                    entries[top++] = rightDistance;
+                }
+            }
+            return found;
+        }
+    };
+
+    class Bvh{
+    public:
+        Bvh() = default;
+        explicit Bvh(std::vector<Triangle> triangles) : _triangles(std::move(triangles)){
+            if(_triangles.size() > std::numeric_limits<uint32_t>::max())
+                throw std::invalid_argument("too many triangles for one hierarchy");
+            if(_triangles.empty())
+                return;
+            _nodes.reserve(2 * _triangles.size() / leafSize + 1);
+            std::vector<Vec3<float>> centroids(_triangles.size());
+            for(size_t i = 0; i < _triangles.size(); ++i)
+                centroids[i] = _triangles[i].centroid();
+            std::vector<uint32_t> order(_triangles.size());
+            for(uint32_t i = 0; i < order.size(); ++i)
+                order[i] = i;
+            build(order, centroids, 0, static_cast<uint32_t>(order.size()), 0);
+
+            std::vector<Triangle> sorted(_triangles.size());
+            for(size_t i = 0; i < order.size(); ++i)
+                sorted[i] = _triangles[order[i]];
+            _triangles.swap(sorted);
+        }
+
+        BvhView view() const { return {_nodes.data(), _nodes.size(), _triangles.data(), _triangles.size()}; }
+        const std::vector<Node>& getNodes() const { return _nodes; }
+        const std::vector<Triangle>& getTriangles() const { return _triangles; }
+
+    private:
+        static constexpr uint32_t leafSize = 4;
+        static constexpr int maxDepth = 60;
+
+        // median split along the longest axis of the centroid bounds
+        uint32_t build(std::vector<uint32_t>& order, const std::vector<Vec3<float>>& centroids,
+                       uint32_t first, uint32_t count, int depth){
+            uint32_t index = static_cast<uint32_t>(_nodes.size());
+            _nodes.push_back({});
+            BoundingBox<float> bounds, centroidBounds;
+            for(uint32_t i = first; i < first + count; ++i){
+                bounds.extend(_triangles[order[i]].bounds());
+                centroidBounds.extend(centroids[order[i]]);
+            }
+            _nodes[index].bounds = padded(bounds);
+            Vec3<float> extent = centroidBounds.size();
+            int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+            float axisExtent = axis == 0 ? extent.x : axis == 1 ? extent.y : extent.z;
+            if(count <= leafSize || depth >= maxDepth || axisExtent <= 0){
+                _nodes[index].first = first;
+                _nodes[index].count = count;
+                return index;
+            }
+            uint32_t half = count / 2;
+            auto begin = order.begin() + first;
+            std::nth_element(begin, begin + half, begin + count, [&](uint32_t l, uint32_t r){
+                return (&centroids[l].x)[axis] < (&centroids[r].x)[axis];
+            });
+            build(order, centroids, first, half, depth + 1);
+            uint32_t right = build(order, centroids, first + half, count - half, depth + 1);
+            _nodes[index].first = right;
+            _nodes[index].count = 0;
+            return index;
+        }
+
+        std::vector<Node> _nodes;
+        std::vector<Triangle> _triangles;
+    };
+
+    inline void write(std::ostream& out, const BvhView& view){
+        FileHeader header = {};
+        std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+        header.version = fileVersion;
+        header.nodeCount = view.nodeCount;
+        header.triangleCount = view.triangleCount;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(view.nodes), sizeof(Node) * view.nodeCount);
+        out.write(reinterpret_cast<const char*>(view.triangles), sizeof(Triangle) * view.triangleCount);
+        if(!out)
+            throw std::runtime_error("cannot write hierarchy");
+    }
+
+    // view over a hierarchy written by write(), the memory must outlive the view
+    inline BvhView view(const void* data, size_t size){
+        FileHeader header;
+        if(size < sizeof(header))
+            throw std::invalid_argument("truncated hierarchy");
+        std::memcpy(&header, data, sizeof(header));
+        if(std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0 || header.version != fileVersion)
+            throw std::invalid_argument("not a hierarchy file");
+        if(size != sizeof(header) + sizeof(Node) * header.nodeCount + sizeof(Triangle) * header.triangleCount)
+            throw std::invalid_argument("truncated hierarchy");
+        const char* bytes = static_cast<const char*>(data) + sizeof(header);
+        BvhView result;
+        result.nodes = reinterpret_cast<const Node*>(bytes);
+        result.nodeCount = header.nodeCount;
+        result.triangles = reinterpret_cast<const Triangle*>(bytes + sizeof(Node) * header.nodeCount);
+        result.triangleCount = header.triangleCount;
+        return result;
+    }
+}//namespace bvh
@@ -0,0 +1,146 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include "../Geometry.h"
+#include "bvh.hpp"
+#include "storage.hpp"
+
+// Hierarchies persisted between runs. A cache file is named and keyed by a
+// content hash of the scene triangles and the projection center, later runs on
+// the same scene map it instead of building the hierarchy again.
+namespace bvh_cache{
+    using namespace geometry;
+
+    struct CacheHeader{
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t hash;
+        Vec3<float> center;
+        float padding;
+    };
+
+    constexpr char cacheMagic[8] = {'P', 'R', 'C', 'A', 'C', 'H', 'E', 0};
+    // bump whenever the hierarchy layout or the build changes
+    constexpr uint32_t cacheVersion = 1;
+
+    // FNV-1a over raw bytes, seed with a previous result to continue a hash
+    inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ull){
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; ++i){
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    inline uint64_t contentHash(const std::vector<bvh::Triangle>& triangles, const Vec3<float>& center){
+        uint64_t hash = fnv1a(&cacheVersion, sizeof(cacheVersion));
+        hash = fnv1a(triangles.data(), sizeof(bvh::Triangle) * triangles.size(), hash);
+        return fnv1a(&center.x, 3 * sizeof(float), hash);
+    }
+
+    inline std::string cachePath(const std::string& directory, uint64_t hash){
+        std::ostringstream name;
+        name << directory << "/scene_" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bvh";
+        return name.str();
+    }
+
+    // hierarchy either built in this run or mapped from the cache
+    class CachedBvh{
+    public:
+        CachedBvh() = default;
+        explicit CachedBvh(bvh::Bvh built) : _built(std::move(built)){}
+        CachedBvh(CachedBvh&&) = default;
+        CachedBvh& operator=(CachedBvh&&) = default;
+
+        bvh::BvhView view() const { return _file.isMapped() ? _mapped : _built.view(); }
+        bool isMapped() const { return _file.isMapped(); }
+        uint64_t getHash() const { return _hash; }
+
+        // maps the cached hierarchy of triangles or builds and stores it
+        static CachedBvh load(std::vector<bvh::Triangle> triangles, const Vec3<float>& center, const std::string& directory){
+            CachedBvh result;
+            result._hash = contentHash(triangles, center);
+            std::string path = cachePath(directory, result._hash);
+            if(result.map(path, center))
+                return result;
+
+            result._built = bvh::Bvh(std::move(triangles));
+            // written under a temporary name so concurrent runs never map a partial file
+            std::string temporary = path + ".tmp" + std::to_string(::getpid()) + "_" + std::to_string(reinterpret_cast<uintptr_t>(&result));
+            {
+                std::ofstream out(temporary, std::ios::binary);
+                CacheHeader header = {};
+                std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+                header.version = cacheVersion;
+                header.hash = result._hash;
+                header.center = center;
+                out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                try{
+                    bvh::write(out, result._built.view());
+                }catch(const std::runtime_error&){
+                    // an unwritable cache only costs the rebuild next time
+                    out.close();
+                    std::remove(temporary.c_str());
+                    return result;
+                }
+            }
+            std::rename(temporary.c_str(), path.c_str());
+            return result;
+        }
+
+        // maps a cache file written by load, for processes that only know its path
+        static CachedBvh open(const std::string& path){
+            CachedBvh result;
+            storage::MappedFile file(path);
+            CacheHeader header;
+            if(file.size() < sizeof(header))
+                throw std::invalid_argument("truncated hierarchy cache " + path);
+            std::memcpy(&header, file.data(), sizeof(header));
+            if(std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != cacheVersion)
+                throw std::invalid_argument("not a hierarchy cache " + path);
+            result._hash = header.hash;
+            result._mapped = bvh::view(static_cast<const char*>(file.data()) + sizeof(header), file.size() - sizeof(header));
+            result._file = std::move(file);
+            return result;
+        }
+
+    private:
+        bool map(const std::string& path, const Vec3<float>& center){
+            std::ifstream probe(path);
+            if(!probe)
+                return false;
+            probe.close();
+            try{
+                storage::MappedFile file(path);
+                CacheHeader header;
+                if(file.size() < sizeof(header))
+                    return false;
+                std::memcpy(&header, file.data(), sizeof(header));
+                if(std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != cacheVersion
+                   || header.hash != _hash || std::memcmp(&header.center.x, &center.x, 3 * sizeof(float)) != 0)
+                    return false;
+                _mapped = bvh::view(static_cast<const char*>(file.data()) + sizeof(header), file.size() - sizeof(header));
+                _file = std::move(file);
+                return true;
+            }catch(const std::exception&){
+                // stale or damaged files are rebuilt and replaced
+                return false;
+            }
+        }
+
+        uint64_t _hash = 0;
+        bvh::Bvh _built;
+        storage::MappedFile _file;
+        bvh::BvhView _mapped;
+    };
+}//namespace bvh_cache
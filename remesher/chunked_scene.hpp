@@ -0,0 +1,480 @@
+#pragma once
+#include <vector>
+#include <list>
+#include <array>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include "../Geometry.h"
+#include "bvh.hpp"
+#include "storage.hpp"
+
+// Out-of-core scene for meshes larger than memory. The OBJ file is streamed
+// twice: vertices are spilled to disk, then triangles are binned into the cells
+// of a uniform grid. A cell holding more than trianglesPerChunk triangles is
+// binned again into a finer grid of its own, until every part fits. Every part
+// becomes a chunk file holding its own hierarchy, which is memory mapped on
+// demand while projecting and unmapped again, least recently used first, once
+// the mapped chunks exceed the budget.
+namespace chunked_scene{
+    using namespace geometry;
+
+    struct BuildOptions{
+        // most triangles of one chunk, larger cells are split
+        size_t trianglesPerChunk = size_t(1) << 20;
+        // bytes of chunk hierarchies kept mapped while projecting
+        size_t memoryBudget = size_t(1) << 30;
+    };
+
+    struct IndexHeader{
+        char magic[8];
+        uint32_t version;
+        uint32_t dims[3];
+        BoundingBox<float> bounds;
+        Vec3<float> center;
+        float radius;
+        uint64_t triangleCount;
+    };
+
+    constexpr char indexMagic[8] = {'P', 'R', 'C', 'H', 'U', 'N', 'K', 0};
+    constexpr uint32_t indexVersion = 2;
+    // finer grids a cell may be split into before the build gives up
+    constexpr unsigned int maxSplitDepth = 4;
+
+    namespace detail{
+        inline std::string indexPath(const std::string& directory){
+            return directory + "/scene.index";
+        }
+        inline std::string chunkPath(const std::string& directory, size_t chunk){
+            return directory + "/chunk_" + std::to_string(chunk) + ".bvh";
+        }
+
+        // splits the longest cell extent until the grid has enough cells
+        inline std::array<uint32_t, 3> gridDims(const BoundingBox<float>& bounds, size_t cells){
+            std::array<uint32_t, 3> dims = {1, 1, 1};
+            Vec3<float> size = bounds.size();
+            const float* extent = &size.x;
+            while(static_cast<size_t>(dims[0]) * dims[1] * dims[2] < cells){
+                int axis = 0;
+                for(int a = 1; a < 3; ++a){
+                    if(extent[a] / dims[a] > extent[axis] / dims[axis])
+                        axis = a;
+                }
+                if(extent[axis] <= 0)
+                    break;
+                dims[axis]++;
+            }
+            return dims;
+        }
+
+        inline BoundingBox<float> cellBounds(const BoundingBox<float>& bounds, const std::array<uint32_t, 3>& dims, size_t cell){
+            uint32_t at[3] = {static_cast<uint32_t>(cell % dims[0]), static_cast<uint32_t>(cell / dims[0] % dims[1]),
+                              static_cast<uint32_t>(cell / dims[0] / dims[1])};
+            BoundingBox<float> result;
+            for(int a = 0; a < 3; ++a){
+                float lo = (&bounds.min.x)[a], size = ((&bounds.max.x)[a] - lo) / dims[a];
+                (&result.min.x)[a] = lo + at[a] * size;
+                (&result.max.x)[a] = at[a] + 1 == dims[a] ? (&bounds.max.x)[a] : lo + (at[a] + 1) * size;
+            }
+            return result;
+        }
+
+        // appends triangles to a file per grid cell their bounds overlap,
+        // buffering at most about half of memoryBudget
+        class Binner{
+        public:
+            Binner(const std::string& prefix, const BoundingBox<float>& bounds, const std::array<uint32_t, 3>& dims, size_t memoryBudget)
+                : _prefix(prefix), _bounds(bounds), _dims(dims)
+                , _counts(static_cast<size_t>(dims[0]) * dims[1] * dims[2], 0), _buffers(_counts.size()){
+                _bufferTriangles = std::max<size_t>(256, memoryBudget / (2 * sizeof(bvh::Triangle) * _counts.size()));
+                Vec3<float> size = bounds.size();
+                for(int a = 0; a < 3; ++a)
+                    (&_cellSize.x)[a] = (&size.x)[a] / dims[a];
+            }
+
+            std::string path(size_t cell) const { return _prefix + std::to_string(cell) + ".tri"; }
+            size_t cellCount() const { return _counts.size(); }
+            const std::vector<uint64_t>& counts() const { return _counts; }
+
+            void add(const bvh::Triangle& tri){
+                BoundingBox<float> box = bvh::padded(tri.bounds());
+                uint32_t lo[3], hi[3];
+                for(int a = 0; a < 3; ++a){
+                    lo[a] = cellOf(box.min, a);
+                    hi[a] = cellOf(box.max, a);
+                }
+                for(uint32_t z = lo[2]; z <= hi[2]; ++z){
+                    for(uint32_t y = lo[1]; y <= hi[1]; ++y){
+                        for(uint32_t x = lo[0]; x <= hi[0]; ++x){
+                            size_t cell = (static_cast<size_t>(z) * _dims[1] + y) * _dims[0] + x;
+                            _buffers[cell].push_back(tri);
+                            if(_buffers[cell].size() >= _bufferTriangles)
+                                flush(cell);
+                        }
+                    }
+                }
+            }
+
+            void finish(){
+                for(size_t cell = 0; cell < _counts.size(); ++cell)
+                    flush(cell);
+            }
+
+        private:
+            uint32_t cellOf(const Vec3<float>& v, int axis) const{
+                float offset = ((&v.x)[axis] - (&_bounds.min.x)[axis]) / (&_cellSize.x)[axis];
+                if(!(offset > 0))
+                    return 0u;
+                if(!(offset < _dims[axis]))
+                    return _dims[axis] - 1;
+                return static_cast<uint32_t>(offset);
+            }
+
+            void flush(size_t cell){
+                auto& buffer = _buffers[cell];
+                if(buffer.empty())
+                    return;
+                auto mode = _counts[cell] == 0 ? std::ios::trunc : std::ios::app;
+                std::ofstream out(path(cell), std::ios::binary | mode);
+                out.write(reinterpret_cast<const char*>(buffer.data()), sizeof(bvh::Triangle) * buffer.size());
+                if(!out)
+                    throw std::runtime_error("cannot write chunk " + path(cell));
+                _counts[cell] += buffer.size();
+                buffer.clear();
+            }
+
+            std::string _prefix;
+            BoundingBox<float> _bounds;
+            std::array<uint32_t, 3> _dims;
+            Vec3<float> _cellSize;
+            size_t _bufferTriangles;
+            std::vector<uint64_t> _counts;
+            std::vector<std::vector<bvh::Triangle>> _buffers;
+        };
+
+        // replaces the binned triangles at path by bins of at most limit
+        // triangles, in a finer grid over bounds, and appends those to parts
+        inline void split(const std::string& path, uint64_t count, const BoundingBox<float>& bounds, const BuildOptions& options,
+                          unsigned int depth, std::vector<std::pair<std::string, uint64_t>>& parts){
+            if(count <= options.trianglesPerChunk){
+                parts.emplace_back(path, count);
+                return;
+            }
+            // twice the cells a perfect split needs, triangles on cell borders are duplicated
+            size_t cells = 2 * ((count + options.trianglesPerChunk - 1) / options.trianglesPerChunk);
+            auto dims = gridDims(bounds, cells);
+            bool progress = depth > 0 && static_cast<size_t>(dims[0]) * dims[1] * dims[2] > 1;
+            Binner binner(path.substr(0, path.size() - 4) + "_", bounds, dims, options.memoryBudget);
+            if(progress){
+                std::ifstream in(path, std::ios::binary);
+                std::vector<bvh::Triangle> batch(std::min<uint64_t>(count, std::max<size_t>(256, options.memoryBudget / (4 * sizeof(bvh::Triangle)))));
+                for(uint64_t read = 0; read < count; read += batch.size()){
+                    size_t n = static_cast<size_t>(std::min<uint64_t>(batch.size(), count - read));
+                    in.read(reinterpret_cast<char*>(batch.data()), sizeof(bvh::Triangle) * n);
+                    if(!in)
+                        throw std::runtime_error("cannot read chunk " + path);
+                    for(size_t i = 0; i < n; ++i)
+                        binner.add(batch[i]);
+                }
+                binner.finish();
+                std::remove(path.c_str());
+                // a cell that kept every triangle is no smaller, e.g. many triangles through one point
+                for(uint64_t c : binner.counts())
+                    progress = progress && c < count;
+            }
+            if(!progress){
+                for(size_t cell = 0; cell < binner.cellCount(); ++cell)
+                    std::remove(binner.path(cell).c_str());
+                std::remove(path.c_str());
+                throw std::runtime_error("a chunk of " + std::to_string(count) + " triangles cannot be split below "
+                                         + std::to_string(options.trianglesPerChunk) + " triangles, raise trianglesPerChunk");
+            }
+            for(size_t cell = 0; cell < binner.cellCount(); ++cell){
+                if(binner.counts()[cell] > 0)
+                    split(binner.path(cell), binner.counts()[cell], cellBounds(bounds, dims, cell), options, depth - 1, parts);
+            }
+        }
+
+        // vertex index of an OBJ face corner, negative indices count from the end
+        inline uint64_t cornerIndex(const std::string& corner, uint64_t vertexCount){
+            long long index = std::strtoll(corner.c_str(), nullptr, 10);
+            if(index < 0)
+                index += static_cast<long long>(vertexCount) + 1;
+            if(index < 1 || static_cast<uint64_t>(index) > vertexCount)
+                throw std::invalid_argument("face references a missing vertex");
+            return static_cast<uint64_t>(index - 1);
+        }
+    }
+
+    class ChunkedScene{
+    public:
+        // opens a scene built before into directory
+        ChunkedScene(const std::string& directory, size_t memoryBudget)
+            : _directory(directory), _memoryBudget(memoryBudget){
+            std::ifstream in(detail::indexPath(directory), std::ios::binary);
+            if(!in)
+                throw std::invalid_argument("no chunked scene in " + directory);
+            in.read(reinterpret_cast<char*>(&_header), sizeof(_header));
+            if(!in || std::memcmp(_header.magic, indexMagic, sizeof(indexMagic)) != 0 || _header.version != indexVersion)
+                throw std::invalid_argument("invalid chunked scene index in " + directory);
+            _chunkTriangles.resize(static_cast<size_t>(_header.dims[0]) * _header.dims[1] * _header.dims[2]);
+            in.read(reinterpret_cast<char*>(_chunkTriangles.data()), sizeof(uint64_t) * _chunkTriangles.size());
+            std::vector<uint32_t> cellChunks(_chunkTriangles.size());
+            in.read(reinterpret_cast<char*>(cellChunks.data()), sizeof(uint32_t) * cellChunks.size());
+            _firstChunk.assign(cellChunks.size() + 1, 0);
+            for(size_t cell = 0; cell < cellChunks.size(); ++cell)
+                _firstChunk[cell + 1] = _firstChunk[cell] + cellChunks[cell];
+            if(!in)
+                throw std::invalid_argument("truncated chunked scene index in " + directory);
+            Vec3<float> size = _header.bounds.size();
+            for(int a = 0; a < 3; ++a)
+                (&_cellSize.x)[a] = (&size.x)[a] / _header.dims[a];
+        }
+
+        // streams an OBJ file into chunks, directory must exist
+        static ChunkedScene build(const std::string& objPath, const std::string& directory, const BuildOptions& options = {}){
+            if(options.trianglesPerChunk == 0 || options.trianglesPerChunk * sizeof(bvh::Triangle) > options.memoryBudget)
+                throw std::invalid_argument("a chunk of trianglesPerChunk triangles must fit the memory budget");
+            std::string spillPath = directory + "/vertices.bin";
+            IndexHeader header = {};
+            std::memcpy(header.magic, indexMagic, sizeof(indexMagic));
+            header.version = indexVersion;
+
+            // first pass, vertices go to disk, faces are only counted
+            uint64_t vertexCount = 0;
+            {
+                std::ifstream in(objPath);
+                if(!in)
+                    throw std::invalid_argument("invalid path to file");
+                std::ofstream spill(spillPath, std::ios::binary);
+                std::string line;
+                while(std::getline(in, line)){
+                    if(line.size() < 2)
+                        continue;
+                    if(line[0] == 'v' && line[1] == ' '){
+                        std::stringstream ss(line.substr(2));
+                        Vec3<float> v;
+                        ss >> v.x >> v.y >> v.z;
+                        spill.write(reinterpret_cast<const char*>(&v.x), 3 * sizeof(float));
+                        header.bounds.extend(v);
+                        vertexCount++;
+                    }else if(line[0] == 'f' && line[1] == ' '){
+                        std::stringstream ss(line.substr(2));
+                        std::string corner;
+                        size_t corners = 0;
+                        while(ss >> corner)
+                            corners++;
+                        if(corners >= 3)
+                            header.triangleCount += corners - 2;
+                    }
+                }
+                if(!spill)
+                    throw std::runtime_error("cannot spill vertices to " + directory);
+            }
+            if(header.triangleCount == 0)
+                throw std::invalid_argument("scene has no triangles");
+            storage::MappedFile vertices(spillPath);
+            const float* positions = static_cast<const float*>(vertices.data());
+            auto vertexAt = [positions](uint64_t i){
+                return Vec3<float>(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+            };
+
+            header.center = header.bounds.center();
+            header.radius = 0;
+            for(uint64_t i = 0; i < vertexCount; ++i)
+                header.radius = std::max(header.radius, distance(header.center, vertexAt(i)));
+
+            size_t cellTarget = std::max<size_t>(1, (header.triangleCount + options.trianglesPerChunk - 1) / options.trianglesPerChunk);
+            auto dims = detail::gridDims(header.bounds, cellTarget);
+            std::copy(dims.begin(), dims.end(), header.dims);
+            size_t cellCount = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+
+            // second pass, triangles are appended to every cell their bounds overlap
+            detail::Binner binner(directory + "/chunk_", header.bounds, dims, options.memoryBudget);
+            {
+                std::ifstream in(objPath);
+                std::string line, corner;
+                std::vector<uint64_t> face;
+                while(std::getline(in, line)){
+                    if(line.size() < 2 || line[0] != 'f' || line[1] != ' ')
+                        continue;
+                    std::stringstream ss(line.substr(2));
+                    face.clear();
+                    while(ss >> corner)
+                        face.push_back(detail::cornerIndex(corner, vertexCount));
+                    for(size_t i = 2; i < face.size(); ++i)
+                        binner.add({vertexAt(face[0]), vertexAt(face[i - 1]), vertexAt(face[i])});
+                }
+                binner.finish();
+            }
+            vertices = storage::MappedFile();
+            std::remove(spillPath.c_str());
+
+            // cells over trianglesPerChunk are split first, so every part
+            // is small enough to build its hierarchy in memory
+            std::vector<uint64_t> cellTriangles = binner.counts();
+            std::vector<uint32_t> cellChunks(cellCount, 0);
+            size_t chunk = 0;
+            for(size_t cell = 0; cell < cellCount; ++cell){
+                if(cellTriangles[cell] == 0)
+                    continue;
+                std::vector<std::pair<std::string, uint64_t>> parts;
+                try{
+                    detail::split(binner.path(cell), cellTriangles[cell], detail::cellBounds(header.bounds, dims, cell),
+                                  options, maxSplitDepth, parts);
+                }catch(...){
+                    for(const auto& part : parts)
+                        std::remove(part.first.c_str());
+                    for(size_t rest = cell + 1; rest < cellCount; ++rest)
+                        std::remove(binner.path(rest).c_str());
+                    throw;
+                }
+                for(const auto& part : parts){
+                    std::vector<bvh::Triangle> triangles(part.second);
+                    {
+                        std::ifstream in(part.first, std::ios::binary);
+                        in.read(reinterpret_cast<char*>(triangles.data()), sizeof(bvh::Triangle) * triangles.size());
+                        if(!in)
+                            throw std::runtime_error("cannot read chunk from " + directory);
+                    }
+                    std::remove(part.first.c_str());
+                    bvh::Bvh hierarchy(std::move(triangles));
+                    std::ofstream out(detail::chunkPath(directory, chunk++), std::ios::binary);
+                    bvh::write(out, hierarchy.view());
+                }
+                cellChunks[cell] = static_cast<uint32_t>(parts.size());
+            }
+
+            std::ofstream index(detail::indexPath(directory), std::ios::binary);
+            index.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            index.write(reinterpret_cast<const char*>(cellTriangles.data()), sizeof(uint64_t) * cellTriangles.size());
+            index.write(reinterpret_cast<const char*>(cellChunks.data()), sizeof(uint32_t) * cellChunks.size());
+            if(!index)
+                throw std::runtime_error("cannot write chunked scene index to " + directory);
+            index.close();
+            return ChunkedScene(directory, options.memoryBudget);
+        }
+
+        ChunkedScene(const ChunkedScene&) = delete;
+        ChunkedScene& operator=(const ChunkedScene&) = delete;
+        ChunkedScene(ChunkedScene&& other) noexcept
+            : _directory(std::move(other._directory))
+            , _memoryBudget(other._memoryBudget)
+            , _header(other._header)
+            , _cellSize(other._cellSize)
+            , _chunkTriangles(std::move(other._chunkTriangles))
+            , _firstChunk(std::move(other._firstChunk)){}
+
+        const BoundingBox<float>& getBounds() const { return _header.bounds; }
+        Vec3<float> getCenter() const { return _header.center; }
+        float getRadius() const { return _header.radius; }
+        // triangles of the source mesh, before binning
+        uint64_t getTriangleCount() const { return _header.triangleCount; }
+        size_t getMappedBytes() const{
+            std::lock_guard<std::mutex> lock(_cacheMutex);
+            return _mappedBytes;
+        }
+
+        // nearest hit of origin + t * direction with t in [0, t], walks the grid
+        // cells along the segment and maps the chunks it needs
+        bool intersect(const Vec3<float>& origin, const Vec3<float>& direction, float& t) const{
+            Vec3<float> inverse = {1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z};
+            float tEnter;
+            if(!bvh::intersectsBox(_header.bounds, origin, inverse, t, tEnter))
+                return false;
+            float tExit = t;
+            int cell[3], step[3];
+            float tNext[3], tDelta[3];
+            for(int a = 0; a < 3; ++a){
+                float o = (&origin.x)[a], d = (&direction.x)[a], size = (&_cellSize.x)[a];
+                float lo = (&_header.bounds.min.x)[a];
+                int dim = static_cast<int>(_header.dims[a]);
+                float offset = size > 0 ? (o + d * tEnter - lo) / size : 0;
+                cell[a] = std::min(dim - 1, std::max(0, static_cast<int>(offset)));
+                if(d > 0 && size > 0){
+                    step[a] = 1;
+                    tNext[a] = (lo + (cell[a] + 1) * size - o) / d;
+                    tDelta[a] = size / d;
+                }else if(d < 0 && size > 0){
+                    step[a] = -1;
+                    tNext[a] = (lo + cell[a] * size - o) / d;
+                    tDelta[a] = -size / d;
+                }else{
+                    step[a] = 0;
+                    tNext[a] = std::numeric_limits<float>::max();
+                    tDelta[a] = 0;
+                }
+            }
+            bool hit = false;
+            while(true){
+                size_t index = (static_cast<size_t>(cell[2]) * _header.dims[1] + cell[1]) * _header.dims[0] + cell[0];
+                for(size_t c = _firstChunk[index]; c < _firstChunk[index + 1]; ++c){
+                    auto chunk = acquire(c);
+                    if(chunk->view.intersect(origin, direction, t))
+                        hit = true;
+                }
+                int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+                // hits closer than the next cell boundary cannot be beaten
+                if(tNext[axis] >= t || tNext[axis] > tExit)
+                    break;
+                cell[axis] += step[axis];
+                if(cell[axis] < 0 || cell[axis] >= static_cast<int>(_header.dims[axis]))
+                    break;
+                tNext[axis] += tDelta[axis];
+            }
+            return hit;
+        }
+
+    private:
+        struct Chunk{
+            storage::MappedFile file;
+            bvh::BvhView view;
+        };
+
+        // mapped chunk, chunks in use by other threads stay mapped
+        // until released even if eviction already dropped them from the cache
+        std::shared_ptr<const Chunk> acquire(size_t index) const{
+            std::lock_guard<std::mutex> lock(_cacheMutex);
+            auto found = _cache.find(index);
+            if(found != _cache.end()){
+                _recent.splice(_recent.begin(), _recent, found->second.second);
+                return found->second.first;
+            }
+            auto chunk = std::make_shared<Chunk>();
+            chunk->file = storage::MappedFile(detail::chunkPath(_directory, index));
+            chunk->view = bvh::view(chunk->file.data(), chunk->file.size());
+            while(!_recent.empty() && _mappedBytes + chunk->file.size() > _memoryBudget){
+                auto evicted = _cache.find(_recent.back());
+                _mappedBytes -= evicted->second.first->file.size();
+                _cache.erase(evicted);
+                _recent.pop_back();
+            }
+            _recent.push_front(index);
+            _cache[index] = {chunk, _recent.begin()};
+            _mappedBytes += chunk->file.size();
+            return chunk;
+        }
+
+        std::string _directory;
+        size_t _memoryBudget;
+        IndexHeader _header;
+        Vec3<float> _cellSize;
+        std::vector<uint64_t> _chunkTriangles;
+        // chunks of cell c are [_firstChunk[c], _firstChunk[c + 1])
+        std::vector<size_t> _firstChunk;
+
+        mutable std::mutex _cacheMutex;
+        mutable std::list<size_t> _recent;
+        mutable std::unordered_map<size_t, std::pair<std::shared_ptr<const Chunk>, std::list<size_t>::iterator>> _cache;
+        mutable size_t _mappedBytes = 0;
+    };
+}//namespace chunked_scene
@@ -0,0 +1,372 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <utility>
+#include "../Geometry.h"
+#include "bvh.hpp"
+#include "parallel.hpp"
+
+// Sparse narrow-band signed distance field of a scene for closest-point
+// projection. A coarse dense grid covers the whole projection domain; coarse
+// cells near the surface also own a brick of finer samples and the list of
+// triangles near the cell. Every sample keeps the signed distance and its
+// gradient, so a vertex is brought near the surface by a few trilinear lookups
+// and Newton steps x -= d * grad(d), then snapped onto the exact closest point
+// among the triangles of its brick instead of a query of the whole scene.
+namespace distance_field{
+    using namespace geometry;
+
+    struct Options{
+        // coarse cells along each axis of the domain
+        unsigned int coarseResolution = 64;
+        // fine cells along each axis of one brick
+        unsigned int brickResolution = 4;
+        unsigned int maxIterations = 8;
+    };
+
+    struct Sample{
+        float distance;
+        Vec3<float> gradient;
+    };
+
+    namespace detail{
+        // Angle weighted pseudonormals of a triangle soup, welded by exact
+        // position. The normal of the feature a closest point lies on gives a
+        // correct inside/outside sign also at shared edges and concave corners,
+        // where the normal of one arbitrary adjacent face does not.
+        struct Pseudonormals{
+            std::vector<Vec3<float>> faces;
+            // three per triangle, of corner a, b and c
+            std::vector<Vec3<float>> corners;
+            // three per triangle, of the edges ab, bc and ca
+            std::vector<Vec3<float>> edges;
+
+            explicit Pseudonormals(const bvh::BvhView& scene){
+                size_t count = scene.triangleCount;
+                faces.resize(count);
+                std::vector<float> angles(3 * count);
+                parallel::forRange(count, [&](size_t begin, size_t end){
+                    for(size_t t = begin; t < end; ++t){
+                        const bvh::Triangle& tri = scene.triangles[t];
+                        Vec3<float> n = getNormal(tri.a, tri.b, tri.c);
+                        float length = n.length();
+                        faces[t] = length > 0 ? n / length : Vec3<float>(0, 0, 0);
+                        const Vec3<float>* p[3] = {&tri.a, &tri.b, &tri.c};
+                        for(int k = 0; k < 3; ++k){
+                            Vec3<float> e1 = *p[(k + 1) % 3] - *p[k], e2 = *p[(k + 2) % 3] - *p[k];
+                            float l = e1.length() * e2.length();
+                            angles[3 * t + k] = l > 0 ? std::acos(std::max(-1.0f, std::min(1.0f, dot(e1, e2) / l))) : 0;
+                        }
+                    }
+                });
+
+                // corners at the same position share a vertex id
+                auto position = [&](size_t corner){
+                    const bvh::Triangle& tri = scene.triangles[corner / 3];
+                    return corner % 3 == 0 ? tri.a : corner % 3 == 1 ? tri.b : tri.c;
+                };
+                std::vector<uint32_t> order(3 * count);
+                for(size_t i = 0; i < order.size(); ++i)
+                    order[i] = static_cast<uint32_t>(i);
+                auto less = [&](uint32_t l, uint32_t r){
+                    Vec3<float> a = position(l), b = position(r);
+                    if(a.x != b.x) return a.x < b.x;
+                    if(a.y != b.y) return a.y < b.y;
+                    return a.z < b.z;
+                };
+                std::sort(order.begin(), order.end(), less);
+                std::vector<uint32_t> vertexOf(order.size());
+                std::vector<Vec3<float>> vertices;
+                for(size_t i = 0; i < order.size(); ++i){
+                    if(i == 0 || less(order[i - 1], order[i]))
+                        vertices.push_back({0, 0, 0});
+                    vertexOf[order[i]] = static_cast<uint32_t>(vertices.size() - 1);
+                    vertices.back() += angles[order[i]] * faces[order[i] / 3];
+                }
+                corners.resize(order.size());
+                for(size_t i = 0; i < order.size(); ++i)
+                    corners[i] = vertices[vertexOf[i]];
+
+                // edges of different triangles between the same vertices sum their face normals
+                std::vector<std::pair<uint64_t, uint32_t>> edgeKeys(3 * count);
+                for(size_t i = 0; i < edgeKeys.size(); ++i){
+                    uint64_t a = vertexOf[i], b = vertexOf[i - i % 3 + (i + 1) % 3];
+                    edgeKeys[i] = {std::min(a, b) << 32 | std::max(a, b), static_cast<uint32_t>(i)};
+                }
+                std::sort(edgeKeys.begin(), edgeKeys.end());
+                edges.resize(edgeKeys.size());
+                for(size_t first = 0; first < edgeKeys.size();){
+                    size_t last = first;
+                    Vec3<float> sum = {0, 0, 0};
+                    while(last < edgeKeys.size() && edgeKeys[last].first == edgeKeys[first].first)
+                        sum += faces[edgeKeys[last++].second / 3];
+                    for(size_t i = first; i < last; ++i)
+                        edges[edgeKeys[i].second] = sum;
+                    first = last;
+                }
+            }
+
+            // pseudonormal of the feature of triangle t that point lies on
+            Vec3<float> at(const bvh::Triangle& tri, size_t t, const Vec3<float>& point) const{
+                Vec3<float> v0 = tri.b - tri.a, v1 = tri.c - tri.a, v2 = point - tri.a;
+                float d00 = dot(v0, v0), d01 = dot(v0, v1), d11 = dot(v1, v1);
+                float d20 = dot(v2, v0), d21 = dot(v2, v1);
+                float denominator = d00 * d11 - d01 * d01;
+                if(!(denominator > 0))
+                    return faces[t];
+                float bary[3];
+                bary[1] = (d11 * d20 - d01 * d21) / denominator;
+                bary[2] = (d00 * d21 - d01 * d20) / denominator;
+                bary[0] = 1 - bary[1] - bary[2];
+                const float epsilon = 1e-5f;
+                int zeros = 0, zero = 0, other = 0;
+                for(int k = 0; k < 3; ++k){
+                    if(bary[k] <= epsilon){
+                        zeros++;
+                        zero = k;
+                    }else{
+                        other = k;
+                    }
+                }
+                if(zeros >= 2)
+                    return corners[3 * t + other];
+                // the edge opposite corner k runs from corner k + 1 to k + 2
+                if(zeros == 1)
+                    return edges[3 * t + (zero + 1) % 3];
+                return faces[t];
+            }
+        };
+    }
+
+    class DistanceField{
+    public:
+        // the domain is the cube around the sphere of domainRadius at center
+        DistanceField(const bvh::BvhView& scene, const Vec3<float>& center, float domainRadius, const Options& options = {})
+            : _coarseResolution(std::max(1u, options.coarseResolution))
+            , _brickResolution(std::max(1u, options.brickResolution))
+            , _maxIterations(options.maxIterations){
+            detail::Pseudonormals normals(scene);
+            float half = domainRadius * 1.01f + std::numeric_limits<float>::min();
+            _origin = center - Vec3<float>(half, half, half);
+            _coarseCell = 2 * half / _coarseResolution;
+            _fineCell = _coarseCell / _brickResolution;
+
+            unsigned int corners = _coarseResolution + 1;
+            _coarse.resize(static_cast<size_t>(corners) * corners * corners);
+            parallel::forRange(_coarse.size(), [&](size_t begin, size_t end){
+                for(size_t i = begin; i < end; ++i){
+                    size_t x = i % corners, y = (i / corners) % corners, z = i / (static_cast<size_t>(corners) * corners);
+                    _coarse[i] = exactSample(scene, normals, _origin + Vec3<float>(x * _coarseCell, y * _coarseCell, z * _coarseCell));
+                }
+            }, 256);
+
+            // coarse cells within half a cell of a triangle get a brick, and the
+            // brick lists those triangles: any point of the cell closer than
+            // half a cell to the surface has its closest triangle in the list
+            size_t cellCount = static_cast<size_t>(_coarseResolution) * _coarseResolution * _coarseResolution;
+            _brickOf.assign(cellCount, -1);
+            _margin = 0.5f * _coarseCell;
+            auto forCells = [&](size_t t, auto&& f){
+                BoundingBox<float> box = scene.triangles[t].bounds();
+                unsigned int lo[3], hi[3];
+                for(int a = 0; a < 3; ++a){
+                    lo[a] = cellIndex((&box.min.x)[a] - _margin, a);
+                    hi[a] = cellIndex((&box.max.x)[a] + _margin, a);
+                }
+                for(unsigned int z = lo[2]; z <= hi[2]; ++z){
+                    for(unsigned int y = lo[1]; y <= hi[1]; ++y){
+                        for(unsigned int x = lo[0]; x <= hi[0]; ++x)
+                            f(cell(x, y, z));
+                    }
+                }
+            };
+            for(size_t t = 0; t < scene.triangleCount; ++t)
+                forCells(t, [&](size_t c){ _brickOf[c] = 0; });
+            std::vector<size_t> brickCells;
+            for(size_t c = 0; c < cellCount; ++c){
+                if(_brickOf[c] == 0){
+                    _brickOf[c] = static_cast<int32_t>(brickCells.size());
+                    brickCells.push_back(c);
+                }
+            }
+            _brickTriangleStart.assign(brickCells.size() + 1, 0);
+            for(size_t t = 0; t < scene.triangleCount; ++t)
+                forCells(t, [&](size_t c){ _brickTriangleStart[_brickOf[c] + 1]++; });
+            for(size_t b = 0; b < brickCells.size(); ++b)
+                _brickTriangleStart[b + 1] += _brickTriangleStart[b];
+            _brickTriangles.resize(_brickTriangleStart.back());
+            std::vector<uint32_t> fill(_brickTriangleStart.begin(), _brickTriangleStart.end() - 1);
+            for(size_t t = 0; t < scene.triangleCount; ++t)
+                forCells(t, [&](size_t c){ _brickTriangles[fill[_brickOf[c]]++] = static_cast<uint32_t>(t); });
+
+            unsigned int fineCorners = _brickResolution + 1;
+            size_t brickSamples = static_cast<size_t>(fineCorners) * fineCorners * fineCorners;
+            _bricks.resize(brickCells.size() * brickSamples);
+            parallel::forRange(brickCells.size(), [&](size_t begin, size_t end){
+                for(size_t b = begin; b < end; ++b){
+                    size_t c = brickCells[b];
+                    size_t cx = c % _coarseResolution, cy = (c / _coarseResolution) % _coarseResolution;
+                    size_t cz = c / (static_cast<size_t>(_coarseResolution) * _coarseResolution);
+                    Vec3<float> corner = _origin + Vec3<float>(cx * _coarseCell, cy * _coarseCell, cz * _coarseCell);
+                    Sample* samples = _bricks.data() + b * brickSamples;
+                    for(size_t i = 0; i < brickSamples; ++i){
+                        size_t x = i % fineCorners, y = (i / fineCorners) % fineCorners, z = i / (fineCorners * fineCorners);
+                        samples[i] = exactSample(scene, normals, corner + Vec3<float>(x * _fineCell, y * _fineCell, z * _fineCell));
+                    }
+                }
+            }, 1);
+        }
+
+        size_t getBrickCount() const { return _bricks.size() / brickSampleCount(); }
+        size_t getMemoryBytes() const{
+            return (_coarse.size() + _bricks.size()) * sizeof(Sample) + _brickOf.size() * sizeof(int32_t)
+                   + (_brickTriangleStart.size() + _brickTriangles.size()) * sizeof(uint32_t);
+        }
+
+        // interpolated distance and gradient, false outside the domain
+        bool sample(const Vec3<float>& p, float& distance, Vec3<float>& gradient) const{
+            Vec3<float> local = (p - _origin) / _coarseCell;
+            unsigned int c[3];
+            float t[3];
+            for(int a = 0; a < 3; ++a){
+                float v = (&local.x)[a];
+                if(!(v >= 0) || v > _coarseResolution)
+                    return false;
+                c[a] = std::min(static_cast<unsigned int>(v), _coarseResolution - 1);
+                t[a] = v - c[a];
+            }
+            int32_t brick = _brickOf[cell(c[0], c[1], c[2])];
+            if(brick < 0){
+                unsigned int corners = _coarseResolution + 1;
+                interpolate(_coarse.data() + (static_cast<size_t>(c[2]) * corners + c[1]) * corners + c[0],
+                            corners, t, distance, gradient);
+                return true;
+            }
+            unsigned int f[3];
+            for(int a = 0; a < 3; ++a){
+                float v = t[a] * _brickResolution;
+                f[a] = std::min(static_cast<unsigned int>(v), _brickResolution - 1);
+                t[a] = v - f[a];
+            }
+            unsigned int corners = _brickResolution + 1;
+            const Sample* samples = _bricks.data() + static_cast<size_t>(brick) * brickSampleCount();
+            interpolate(samples + (static_cast<size_t>(f[2]) * corners + f[1]) * corners + f[0], corners, t, distance, gradient);
+            return true;
+        }
+
+        // moves v onto the nearest surface, returns false when the field did not
+        // converge and the exact closest point of scene was used instead; scene
+        // must be the one the field was built from. Either way v ends on a triangle.
+        bool project(Vec3<float>& v, const bvh::BvhView& scene) const{
+            Vec3<float> x = v;
+            float distance;
+            Vec3<float> gradient;
+            float tolerance = 1e-3f * _fineCell;
+            bool converged = false;
+            for(unsigned int i = 0; i <= _maxIterations; ++i){
+                if(!sample(x, distance, gradient))
+                    break;
+                if(std::abs(distance) <= tolerance || (i == _maxIterations && std::abs(distance) < 0.1f * _fineCell)){
+                    converged = true;
+                    break;
+                }
+                float length = gradient.length();
+                if(i == _maxIterations || length == 0)
+                    break;
+                x -= (distance / length) * gradient;
+            }
+            if(converged && snap(x, scene, v))
+                return true;
+            float best = std::numeric_limits<float>::max();
+            Vec3<float> point;
+            uint32_t triangle;
+            if(scene.closestPoint(v, best, point, triangle))
+                v = point;
+            return false;
+        }
+
+    private:
+        // exact closest point of p among the triangles of the brick around it,
+        // false when p has no brick or is farther than the lists cover
+        bool snap(const Vec3<float>& p, const bvh::BvhView& scene, Vec3<float>& result) const{
+            int32_t brick = _brickOf[cell(cellIndex(p.x, 0), cellIndex(p.y, 1), cellIndex(p.z, 2))];
+            if(brick < 0)
+                return false;
+            float best = _margin * _margin;
+            bool found = false;
+            for(uint32_t i = _brickTriangleStart[brick]; i < _brickTriangleStart[brick + 1]; ++i){
+                Vec3<float> candidate = bvh::closestPointOnTriangle(scene.triangles[_brickTriangles[i]], p);
+                float d = (candidate - p).lengthSquared();
+                if(d < best){
+                    best = d;
+                    result = candidate;
+                    found = true;
+                }
+            }
+            return found;
+        }
+
+        size_t cell(unsigned int x, unsigned int y, unsigned int z) const{
+            return (static_cast<size_t>(z) * _coarseResolution + y) * _coarseResolution + x;
+        }
+
+        unsigned int cellIndex(float coordinate, int axis) const{
+            float v = (coordinate - (&_origin.x)[axis]) / _coarseCell;
+            if(!(v > 0))
+                return 0;
+            return std::min(static_cast<unsigned int>(v), _coarseResolution - 1);
+        }
+
+        size_t brickSampleCount() const{
+            size_t corners = _brickResolution + 1;
+            return corners * corners * corners;
+        }
+
+        // the sign comes from the pseudonormal of the closest feature, the
+        // gradient points away from the surface outside and toward it inside
+        static Sample exactSample(const bvh::BvhView& scene, const detail::Pseudonormals& normals, const Vec3<float>& p){
+            float best = std::numeric_limits<float>::max();
+            Vec3<float> point;
+            uint32_t triangle = 0;
+            if(!scene.closestPoint(p, best, point, triangle))
+                return {std::numeric_limits<float>::max(), {0, 0, 0}};
+            Vec3<float> normal = normals.at(scene.triangles[triangle], triangle, point);
+            Vec3<float> offset = p - point;
+            float distance = std::sqrt(best);
+            float sign = dot(offset, normal) < 0 ? -1.0f : 1.0f;
+            if(distance > 0)
+                return {sign * distance, offset * (sign / distance)};
+            float length = normal.length();
+            return {0, length > 0 ? normal / length : Vec3<float>(0, 0, 0)};
+        }
+
+        static void interpolate(const Sample* base, size_t corners, const float* t, float& distance, Vec3<float>& gradient){
+            distance = 0;
+            gradient = {0, 0, 0};
+            for(int corner = 0; corner < 8; ++corner){
+                int dx = corner & 1, dy = (corner >> 1) & 1, dz = corner >> 2;
+                float weight = (dx ? t[0] : 1 - t[0]) * (dy ? t[1] : 1 - t[1]) * (dz ? t[2] : 1 - t[2]);
+                const Sample& s = base[(dz * corners + dy) * corners + dx];
+                distance += weight * s.distance;
+                gradient += weight * s.gradient;
+            }
+        }
+
+        unsigned int _coarseResolution;
+        unsigned int _brickResolution;
+        unsigned int _maxIterations;
+        Vec3<float> _origin;
+        float _coarseCell;
+        float _fineCell;
+        float _margin;
+        std::vector<Sample> _coarse;
+        std::vector<int32_t> _brickOf;
+        std::vector<Sample> _bricks;
+        // triangles of brick b are _brickTriangles[_brickTriangleStart[b], _brickTriangleStart[b + 1])
+        std::vector<uint32_t> _brickTriangleStart;
+        std::vector<uint32_t> _brickTriangles;
+    };
+}//namespace distance_field
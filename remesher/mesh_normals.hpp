@@ -0,0 +1,157 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "../Geometry.h"
+#include "../Vec3Array.h"
+#include "../Model.h"
+#include "parallel.hpp"
+
+// Area-weighted smooth vertex normals. Every vertex gathers the face normals of
+// its own triangles through a CSR adjacency, so threads never write shared data.
+namespace mesh_normals{
+    using namespace geometry;
+
+    // triangles around each vertex, triangles[offsets[v] .. offsets[v + 1])
+    struct Adjacency{
+        std::vector<unsigned int> offsets;
+        std::vector<unsigned int> triangles;
+    };
+
+    template <typename CornerVertex>
+    Adjacency buildAdjacency(size_t cornerCount, size_t vertexCount, CornerVertex corner){
+        Adjacency result;
+        result.offsets.assign(vertexCount + 1, 0);
+        for(size_t c = 0; c < cornerCount; ++c)
+            result.offsets[corner(c) + 1]++;
+        for(size_t v = 0; v < vertexCount; ++v)
+            result.offsets[v + 1] += result.offsets[v];
+        result.triangles.resize(cornerCount);
+        std::vector<unsigned int> fill(result.offsets.begin(), result.offsets.end() - 1);
+        for(size_t c = 0; c < cornerCount; ++c)
+            result.triangles[fill[corner(c)]++] = static_cast<unsigned int>(c / 3);
+        return result;
+    }
+
+    // corner(c) is the vertex of corner c, three corners per triangle
+    template <typename CornerVertex>
+    std::vector<Vec3<float>> computeVertexNormals(const Vec3Array& positions,
+                                                 size_t cornerCount, CornerVertex corner){
+        size_t triangles = cornerCount / 3;
+        std::vector<Vec3<float>> faceNormals(triangles);
+        parallel::forRange(triangles, [&](size_t begin, size_t end){
+            for(size_t t = begin; t < end; ++t){
+                // the cross product length is twice the area, which is the weight
+                faceNormals[t] = getNormal(positions[corner(3 * t)], positions[corner(3 * t + 1)], positions[corner(3 * t + 2)]);
+            }
+        });
+
+        Adjacency adjacency = buildAdjacency(triangles * 3, positions.size(), corner);
+        std::vector<Vec3<float>> normals(positions.size());
+        parallel::forRange(positions.size(), [&](size_t begin, size_t end){
+            for(size_t v = begin; v < end; ++v){
+                Vec3<float> sum(0, 0, 0);
+                for(unsigned int a = adjacency.offsets[v]; a < adjacency.offsets[v + 1]; ++a)
+                    sum += faceNormals[adjacency.triangles[a]];
+                float length = sum.length();
+                normals[v] = length > 0 ? sum / length : sum;
+            }
+        });
+        return normals;
+    }
+
+    // smooth normals of a fixed topology whose positions change in places; an
+    // update recomputes only the triangles around moved vertices and the
+    // normals of their corners
+    class NormalUpdater{
+    public:
+        // three corner vertices per triangle
+        NormalUpdater(const Vec3Array& positions, std::vector<unsigned int> corners)
+            : _corners(std::move(corners))
+            , _adjacency(buildAdjacency(_corners.size(), positions.size(), [this](size_t c){ return _corners[c]; }))
+            , _faceNormals(_corners.size() / 3){}
+
+        std::vector<Vec3<float>> compute(const Vec3Array& positions){
+            parallel::forRange(_faceNormals.size(), [&](size_t begin, size_t end){
+                for(size_t t = begin; t < end; ++t)
+                    _faceNormals[t] = faceNormal(positions, t);
+            });
+            std::vector<Vec3<float>> normals(positions.size());
+            parallel::forRange(normals.size(), [&](size_t begin, size_t end){
+                for(size_t v = begin; v < end; ++v)
+                    normals[v] = vertexNormal(v);
+            });
+            return normals;
+        }
+
+        // normals must hold the result of compute or of earlier updates
+        void update(const Vec3Array& positions, const std::vector<unsigned int>& moved, std::vector<Vec3<float>>& normals){
+            std::vector<unsigned int> triangles, vertices;
+            for(unsigned int v : moved)
+                triangles.insert(triangles.end(), _adjacency.triangles.begin() + _adjacency.offsets[v],
+                                 _adjacency.triangles.begin() + _adjacency.offsets[v + 1]);
+            std::sort(triangles.begin(), triangles.end());
+            triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+            for(unsigned int t : triangles){
+                _faceNormals[t] = faceNormal(positions, t);
+                vertices.insert(vertices.end(), _corners.begin() + 3 * t, _corners.begin() + 3 * t + 3);
+            }
+            std::sort(vertices.begin(), vertices.end());
+            vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+            for(unsigned int v : vertices)
+                normals[v] = vertexNormal(v);
+        }
+
+    private:
+        Vec3<float> faceNormal(const Vec3Array& positions, size_t t) const{
+            return getNormal(positions[_corners[3 * t]], positions[_corners[3 * t + 1]], positions[_corners[3 * t + 2]]);
+        }
+
+        Vec3<float> vertexNormal(size_t v) const{
+            Vec3<float> sum(0, 0, 0);
+            for(unsigned int a = _adjacency.offsets[v]; a < _adjacency.offsets[v + 1]; ++a)
+                sum += _faceNormals[_adjacency.triangles[a]];
+            float length = sum.length();
+            return length > 0 ? sum / length : sum;
+        }
+
+        std::vector<unsigned int> _corners;
+        Adjacency _adjacency;
+        std::vector<Vec3<float>> _faceNormals;
+    };
+
+    // replaces all normals of the model by smooth normals of its current positions
+    inline void recomputeNormals(Model& model){
+        if(!model.getIndices().empty()){
+            const auto& indices = model.getIndices();
+            model.getNormals() = computeVertexNormals(model.getVertices(), indices.size(),
+                                                      [&](size_t c){ return indices[c]; });
+            model.updateGeometry();
+            return;
+        }
+        auto& packs = model.getIndexPacks();
+        model.getNormals() = computeVertexNormals(model.getVertices(), packs.size(),
+                                                  [&](size_t c){ return packs[c].vertex; });
+        for(auto& pack : packs)
+            pack.normal = pack.vertex;
+        model.updateGeometry();
+    }
+
+    // gives smooth normals to the index packs that have none, explicit normals stay
+    inline void fillMissingNormals(Model& model){
+        auto& packs = model.getIndexPacks();
+        bool missing = false;
+        for(const auto& pack : packs)
+            missing |= !pack.normal;
+        if(!missing)
+            return;
+        auto smooth = computeVertexNormals(model.getVertices(), packs.size(),
+                                           [&](size_t c){ return packs[c].vertex; });
+        auto& normals = model.getNormals();
+        unsigned int base = static_cast<unsigned int>(normals.size());
+        normals.insert(normals.end(), smooth.begin(), smooth.end());
+        for(auto& pack : packs){
+            if(!pack.normal)
+                pack.normal = base + pack.vertex;
+        }
+    }
+}//namespace mesh_normals
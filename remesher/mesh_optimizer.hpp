@@ -0,0 +1,211 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include "../Model.h"
+
+// Reorders triangles for post-transform cache reuse (Forsyth's linear-speed
+// vertex cache optimisation) and vertices for fetch locality.
+namespace mesh_optimizer{
+
+    struct Report{
+        float acmrBefore = 0;
+        float acmrAfter = 0;
+    };
+
+    // average cache miss ratio, transformed vertices per triangle for a FIFO cache
+    inline float computeAcmr(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = 16){
+        if(indices.size() < 3)
+            return 0;
+        std::vector<size_t> insertedAt(vertexCount, 0);
+        size_t time = 0;
+        size_t misses = 0;
+        for(unsigned int v : indices){
+            // a vertex is resident while fewer than cacheSize misses followed its insertion
+            if(insertedAt[v] == 0 || time - insertedAt[v] >= cacheSize){
+                ++time;
+                insertedAt[v] = time;
+                ++misses;
+            }
+        }
+        return misses / static_cast<float>(indices.size() / 3);
+    }
+
+    namespace detail{
+        constexpr int cacheSize = 32;
+        constexpr int maxValence = 64;
+
+        inline float vertexScore(int cachePosition, unsigned int remaining){
+            if(remaining == 0)
+                return -1.0f;
+            float score = 0;
+            if(cachePosition >= 3){
+                score = std::pow(1.0f - (cachePosition - 3) / float(cacheSize - 3), 1.5f);
+            }else if(cachePosition >= 0){
+                // vertices of the last triangle were just used, prefer a fresh one
+                score = 0.75f;
+            }
+            return score + 2.0f / std::sqrt(static_cast<float>(std::min<unsigned int>(remaining, maxValence)));
+        }
+    }
+
+    // triangle order for [first, first + count) of indices, other indices are untouched.
+    // The vertices of the range are renumbered densely, so the work arrays are
+    // sized by the range and not by the whole model.
+    inline void optimizeVertexCache(std::vector<unsigned int>& indices, size_t first, size_t count){
+        using namespace detail;
+        size_t triangles = count / 3;
+        if(triangles < 2)
+            return;
+        std::vector<unsigned int> vertices(indices.begin() + first, indices.begin() + first + triangles * 3);
+        std::sort(vertices.begin(), vertices.end());
+        vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+        size_t vertexCount = vertices.size();
+        std::vector<unsigned int> local(triangles * 3);
+        for(size_t i = 0; i < local.size(); ++i)
+            local[i] = static_cast<unsigned int>(std::lower_bound(vertices.begin(), vertices.end(), indices[first + i]) - vertices.begin());
+        const unsigned int* source = local.data();
+
+        std::vector<unsigned int> offsets(vertexCount + 1, 0);
+        for(size_t i = 0; i < triangles * 3; ++i)
+            offsets[source[i] + 1]++;
+        for(size_t v = 0; v < vertexCount; ++v)
+            offsets[v + 1] += offsets[v];
+        std::vector<unsigned int> adjacency(triangles * 3);
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for(size_t i = 0; i < triangles * 3; ++i)
+            adjacency[fill[source[i]]++] = static_cast<unsigned int>(i / 3);
+
+        std::vector<unsigned int> remaining(vertexCount);
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> score(vertexCount);
+        for(size_t v = 0; v < vertexCount; ++v){
+            remaining[v] = offsets[v + 1] - offsets[v];
+            score[v] = vertexScore(-1, remaining[v]);
+        }
+        std::vector<float> triangleScore(triangles);
+        std::vector<bool> emitted(triangles, false);
+        for(size_t t = 0; t < triangles; ++t)
+            triangleScore[t] = score[source[3 * t]] + score[source[3 * t + 1]] + score[source[3 * t + 2]];
+
+        std::vector<unsigned int> result;
+        result.reserve(triangles * 3);
+        std::vector<unsigned int> cache;
+        std::vector<unsigned int> nextCache;
+        size_t scanPosition = 0;
+        long best = static_cast<long>(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+
+        while(best >= 0){
+            emitted[best] = true;
+            std::array<unsigned int, 3> corners = {source[3 * best], source[3 * best + 1], source[3 * best + 2]};
+            nextCache.assign(corners.begin(), corners.end());
+            for(unsigned int v : corners){
+                result.push_back(v);
+                remaining[v]--;
+            }
+            for(unsigned int v : cache){
+                if(v != corners[0] && v != corners[1] && v != corners[2])
+                    nextCache.push_back(v);
+            }
+            // vertices pushed out of the cache lose their position bonus
+            for(size_t i = 0; i < nextCache.size(); ++i){
+                unsigned int v = nextCache[i];
+                cachePosition[v] = i < static_cast<size_t>(cacheSize) ? static_cast<int>(i) : -1;
+                float updated = vertexScore(cachePosition[v], remaining[v]);
+                float delta = updated - score[v];
+                score[v] = updated;
+                for(unsigned int a = offsets[v]; a < offsets[v + 1]; ++a)
+                    triangleScore[adjacency[a]] += delta;
+            }
+            if(nextCache.size() > static_cast<size_t>(cacheSize))
+                nextCache.resize(cacheSize);
+            cache.swap(nextCache);
+
+            best = -1;
+            float bestScore = -std::numeric_limits<float>::max();
+            for(unsigned int v : cache){
+                for(unsigned int a = offsets[v]; a < offsets[v + 1]; ++a){
+                    unsigned int t = adjacency[a];
+                    if(!emitted[t] && triangleScore[t] > bestScore){
+                        bestScore = triangleScore[t];
+                        best = t;
+                    }
+                }
+            }
+            if(best < 0){
+                while(scanPosition < triangles && emitted[scanPosition])
+                    ++scanPosition;
+                if(scanPosition < triangles)
+                    best = static_cast<long>(scanPosition);
+            }
+        }
+        for(size_t i = 0; i < result.size(); ++i)
+            indices[first + i] = vertices[result[i]];
+    }
+
+    // new index of every vertex, in order of first use by the indices
+    inline std::vector<unsigned int> fetchRemap(const std::vector<unsigned int>& indices, size_t vertexCount){
+        const unsigned int unused = std::numeric_limits<unsigned int>::max();
+        std::vector<unsigned int> remap(vertexCount, unused);
+        unsigned int next = 0;
+        for(unsigned int v : indices){
+            if(remap[v] == unused)
+                remap[v] = next++;
+        }
+        for(auto& r : remap){
+            if(r == unused)
+                r = next++;
+        }
+        return remap;
+    }
+
+    template <typename T>
+    void applyRemap(std::vector<T>& values, const std::vector<unsigned int>& remap){
+        if(values.size() != remap.size())
+            return;
+        std::vector<T> reordered(values.size());
+        for(size_t i = 0; i < values.size(); ++i)
+            reordered[remap[i]] = values[i];
+        values.swap(reordered);
+    }
+
+    inline void applyRemap(geometry::Vec3Array& values, const std::vector<unsigned int>& remap){
+        if(values.size() != remap.size())
+            return;
+        geometry::Vec3Array reordered(values.size());
+        for(size_t i = 0; i < values.size(); ++i)
+            reordered.set(remap[i], values[i]);
+        values.swap(reordered);
+    }
+
+    // optimizes the GPU layout of a model chunk by chunk, so frustum culling ranges stay intact
+    inline Report optimizeModel(Model& model){
+        model.makeIndices();
+        auto& indices = model.getIndices();
+        size_t vertexCount = model.getVertices().size();
+        Report report;
+        report.acmrBefore = computeAcmr(indices, vertexCount);
+        for(const auto& chunk : model.getChunks())
+            optimizeVertexCache(indices, chunk.firstIndex, chunk.indexCount);
+
+        std::vector<unsigned int> remap = fetchRemap(indices, vertexCount);
+        for(auto& i : indices)
+            i = remap[i];
+        applyRemap(model.getVertices(), remap);
+        applyRemap(model.getNormals(), remap);
+        applyRemap(model.getTexCoords(), remap);
+
+        // packs mirror the expanded layout so they stay consistent with the indices
+        auto& packs = model.getIndexPacks();
+        packs.clear();
+        packs.reserve(indices.size());
+        for(unsigned int i : indices)
+            packs.emplace_back(i, i, i);
+
+        report.acmrAfter = computeAcmr(indices, vertexCount);
+        model.updateGeometry();
+        return report;
+    }
+}//namespace mesh_optimizer
@@ -0,0 +1,305 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <tuple>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include "../Geometry.h"
+
+// Quadric error edge-collapse simplification. Vertices are collapsed onto one of
+// their neighbours, so every level indexes the vertex array of the full mesh and
+// levels can share a single vertex buffer.
+namespace mesh_simplifier{
+    using namespace geometry;
+
+    struct Level{
+        std::vector<unsigned int> indices;
+        // RMS distance of the collapsed surface from the original, in model units
+        float error;
+    };
+
+    // symmetric 4x4 matrix of the plane equations plus the area they cover
+    struct Quadric{
+        double a2 = 0, ab = 0, ac = 0, ad = 0;
+        double b2 = 0, bc = 0, bd = 0;
+        double c2 = 0, cd = 0;
+        double d2 = 0;
+        double weight = 0;
+
+        static Quadric fromPlane(double a, double b, double c, double d, double weight){
+            Quadric q;
+            q.a2 = a * a * weight; q.ab = a * b * weight; q.ac = a * c * weight; q.ad = a * d * weight;
+            q.b2 = b * b * weight; q.bc = b * c * weight; q.bd = b * d * weight;
+            q.c2 = c * c * weight; q.cd = c * d * weight;
+            q.d2 = d * d * weight;
+            q.weight = weight;
+            return q;
+        }
+
+        Quadric& operator+=(const Quadric& q){
+            a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+            b2 += q.b2; bc += q.bc; bd += q.bd;
+            c2 += q.c2; cd += q.cd;
+            d2 += q.d2;
+            weight += q.weight;
+            return *this;
+        }
+
+        double evaluate(const Vec3<float>& v) const{
+            double x = v.x, y = v.y, z = v.z;
+            double result = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+                          + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+                          + c2 * z * z + 2 * cd * z
+                          + d2;
+            return std::max(result, 0.0);
+        }
+    };
+
+    class Simplifier{
+    public:
+        Simplifier(const std::vector<Vec3<float>>& positions, const std::vector<unsigned int>& indices){
+            weld(positions);
+            _triangles.reserve(indices.size() / 3);
+            for(size_t i = 2; i < indices.size(); i += 3){
+                Triangle t = {_vertexRep[indices[i - 2]], _vertexRep[indices[i - 1]], _vertexRep[indices[i]]};
+                if(t[0] != t[1] && t[1] != t[2] && t[2] != t[0])
+                    _triangles.push_back(t);
+            }
+            _remap.resize(_positions.size());
+            for(unsigned int v = 0; v < _remap.size(); ++v)
+                _remap[v] = v;
+            computeQuadrics();
+        }
+
+        size_t getTriangleCount() const { return _triangles.size(); }
+        float getError() const { return static_cast<float>(std::sqrt(_error)); }
+
+        // collapses edges until at most targetTriangles remain or no edge can be collapsed
+        void reduceTo(size_t targetTriangles){
+            while(_triangles.size() > targetTriangles){
+                if(!collapsePass(targetTriangles))
+                    break;
+            }
+        }
+
+        // current triangles expressed with indices of the original vertex array
+        std::vector<unsigned int> getIndices() const{
+            std::vector<unsigned int> result;
+            result.reserve(_triangles.size() * 3);
+            for(const auto& t : _triangles){
+                for(unsigned int v : t)
+                    result.push_back(_repVertex[v]);
+            }
+            return result;
+        }
+
+    private:
+        using Triangle = std::array<unsigned int, 3>;
+
+        struct Collapse{
+            double cost;
+            unsigned int from;
+            unsigned int to;
+            bool operator<(const Collapse& rhs) const { return cost < rhs.cost; }
+        };
+
+        // vertices split only by attributes are merged, collapses work on positions
+        void weld(const std::vector<Vec3<float>>& positions){
+            struct KeyHash{
+                size_t operator()(const std::array<uint32_t, 3>& k) const{
+                    return (k[0] * 73856093u) ^ (k[1] * 19349663u) ^ (k[2] * 83492791u);
+                }
+            };
+            std::unordered_map<std::array<uint32_t, 3>, unsigned int, KeyHash> lookup;
+            lookup.reserve(positions.size());
+            _vertexRep.resize(positions.size());
+            for(unsigned int i = 0; i < positions.size(); ++i){
+                std::array<uint32_t, 3> key;
+                std::memcpy(key.data(), &positions[i].x, sizeof(float));
+                std::memcpy(key.data() + 1, &positions[i].y, sizeof(float));
+                std::memcpy(key.data() + 2, &positions[i].z, sizeof(float));
+                auto inserted = lookup.insert({key, static_cast<unsigned int>(_positions.size())});
+                if(inserted.second){
+                    _positions.push_back(positions[i]);
+                    _repVertex.push_back(i);
+                }
+                _vertexRep[i] = inserted.first->second;
+            }
+        }
+
+        void computeQuadrics(){
+            _quadrics.assign(_positions.size(), Quadric());
+            std::vector<std::tuple<unsigned int, unsigned int, unsigned int>> edges;
+            edges.reserve(_triangles.size() * 3);
+            for(size_t t = 0; t < _triangles.size(); ++t){
+                const auto& tri = _triangles[t];
+                auto normal = getNormal(_positions[tri[0]], _positions[tri[1]], _positions[tri[2]]);
+                double area = normal.length();
+                if(area == 0)
+                    continue;
+                normal /= static_cast<float>(area);
+                double d = -dot(normal, _positions[tri[0]]);
+                Quadric q = Quadric::fromPlane(normal.x, normal.y, normal.z, d, area * 0.5);
+                for(unsigned int v : tri)
+                    _quadrics[v] += q;
+                for(int e = 0; e < 3; ++e){
+                    unsigned int a = tri[e], b = tri[(e + 1) % 3];
+                    edges.emplace_back(std::min(a, b), std::max(a, b), static_cast<unsigned int>(t));
+                }
+            }
+            // edges used by a single triangle get a perpendicular plane so the border stays in place
+            std::sort(edges.begin(), edges.end());
+            for(size_t i = 0; i < edges.size(); ++i){
+                bool shared = (i > 0 && std::get<0>(edges[i - 1]) == std::get<0>(edges[i]) && std::get<1>(edges[i - 1]) == std::get<1>(edges[i]))
+                    || (i + 1 < edges.size() && std::get<0>(edges[i + 1]) == std::get<0>(edges[i]) && std::get<1>(edges[i + 1]) == std::get<1>(edges[i]));
+                if(shared)
+                    continue;
+                unsigned int a = std::get<0>(edges[i]), b = std::get<1>(edges[i]);
+                const auto& tri = _triangles[std::get<2>(edges[i])];
+                auto faceNormal = getNormal(_positions[tri[0]], _positions[tri[1]], _positions[tri[2]]);
+                auto edge = _positions[b] - _positions[a];
+                auto normal = cross(edge, faceNormal);
+                float length = normal.length();
+                if(length == 0)
+                    continue;
+                normal /= length;
+                double d = -dot(normal, _positions[a]);
+                Quadric q = Quadric::fromPlane(normal.x, normal.y, normal.z, d, edge.lengthSquared() * borderWeight);
+                _quadrics[a] += q;
+                _quadrics[b] += q;
+            }
+        }
+
+        bool flips(unsigned int from, unsigned int to, size_t triangle) const{
+            const auto& t = _triangles[triangle];
+            Vec3<float> corners[3];
+            for(int i = 0; i < 3; ++i)
+                corners[i] = _positions[t[i]];
+            auto before = getNormal(corners[0], corners[1], corners[2]);
+            for(int i = 0; i < 3; ++i){
+                if(t[i] == from)
+                    corners[i] = _positions[to];
+            }
+            auto after = getNormal(corners[0], corners[1], corners[2]);
+            return dot(before, after) <= 0.25f * before.length() * after.length();
+        }
+
+        bool collapsePass(size_t targetTriangles){
+            std::vector<std::pair<unsigned int, unsigned int>> edges;
+            edges.reserve(_triangles.size() * 3);
+            for(const auto& t : _triangles){
+                for(int e = 0; e < 3; ++e)
+                    edges.emplace_back(std::min(t[e], t[(e + 1) % 3]), std::max(t[e], t[(e + 1) % 3]));
+            }
+            std::sort(edges.begin(), edges.end());
+            edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+            std::vector<Collapse> collapses;
+            collapses.reserve(edges.size());
+            for(const auto& e : edges){
+                Quadric q = _quadrics[e.first];
+                q += _quadrics[e.second];
+                double toSecond = q.evaluate(_positions[e.second]);
+                double toFirst = q.evaluate(_positions[e.first]);
+                double weight = std::max(q.weight, std::numeric_limits<double>::min());
+                if(toSecond <= toFirst)
+                    collapses.push_back({toSecond / weight, e.first, e.second});
+                else
+                    collapses.push_back({toFirst / weight, e.second, e.first});
+            }
+            std::sort(collapses.begin(), collapses.end());
+
+            // vertex -> triangles adjacency for the flip test
+            std::vector<unsigned int> offsets(_positions.size() + 1, 0);
+            for(const auto& t : _triangles){
+                for(unsigned int v : t)
+                    offsets[v + 1]++;
+            }
+            for(size_t v = 0; v < _positions.size(); ++v)
+                offsets[v + 1] += offsets[v];
+            std::vector<unsigned int> adjacency(offsets.back());
+            std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+            for(unsigned int t = 0; t < _triangles.size(); ++t){
+                for(unsigned int v : _triangles[t])
+                    adjacency[fill[v]++] = t;
+            }
+
+            std::vector<bool> locked(_positions.size(), false);
+            size_t remaining = _triangles.size();
+            bool collapsed = false;
+            for(const auto& c : collapses){
+                if(remaining <= targetTriangles)
+                    break;
+                if(locked[c.from] || locked[c.to])
+                    continue;
+                bool valid = true;
+                size_t removed = 0;
+                for(unsigned int i = offsets[c.from]; i < offsets[c.from + 1] && valid; ++i){
+                    const auto& t = _triangles[adjacency[i]];
+                    if(t[0] == c.to || t[1] == c.to || t[2] == c.to)
+                        removed++;
+                    else
+                        valid = !flips(c.from, c.to, adjacency[i]);
+                }
+                if(!valid)
+                    continue;
+                for(unsigned int i = offsets[c.from]; i < offsets[c.from + 1]; ++i){
+                    for(unsigned int v : _triangles[adjacency[i]])
+                        locked[v] = true;
+                }
+                _remap[c.from] = c.to;
+                _quadrics[c.to] += _quadrics[c.from];
+                _error = std::max(_error, c.cost);
+                remaining -= removed;
+                collapsed = true;
+            }
+            if(!collapsed)
+                return false;
+
+            size_t kept = 0;
+            for(const auto& t : _triangles){
+                Triangle mapped = {_remap[t[0]], _remap[t[1]], _remap[t[2]]};
+                if(mapped[0] != mapped[1] && mapped[1] != mapped[2] && mapped[2] != mapped[0])
+                    _triangles[kept++] = mapped;
+            }
+            _triangles.resize(kept);
+            for(unsigned int v = 0; v < _remap.size(); ++v)
+                _remap[v] = v;
+            return true;
+        }
+
+        static constexpr double borderWeight = 10.0;
+
+        std::vector<Vec3<float>> _positions;
+        std::vector<unsigned int> _vertexRep;
+        std::vector<unsigned int> _repVertex;
+        std::vector<Quadric> _quadrics;
+        std::vector<unsigned int> _remap;
+        std::vector<Triangle> _triangles;
+        double _error = 0;
+    };
+
+    // successively halved levels, the full mesh itself is not included
+    inline std::vector<Level> buildLodChain(const std::vector<Vec3<float>>& positions,
+                                            const std::vector<unsigned int>& indices,
+                                            size_t minTriangles = 256,
+                                            float ratio = 0.5f){
+        std::vector<Level> levels;
+        Simplifier simplifier(positions, indices);
+        size_t current = indices.size() / 3;
+        while(current > minTriangles){
+            size_t target = std::max(minTriangles, static_cast<size_t>(current * ratio));
+            simplifier.reduceTo(target);
+            size_t reached = simplifier.getTriangleCount();
+            // give up once a pass stops making real progress
+            if(reached > current * (1 + ratio) / 2)
+                break;
+            levels.push_back({simplifier.getIndices(), simplifier.getError()});
+            current = reached;
+        }
+        return levels;
+    }
+}//namespace mesh_simplifier
@@ -0,0 +1,153 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include "../Geometry.h"
+#include "../Vec3Array.h"
+#include "../Model.h"
+#include "parallel.hpp"
+
+// Merges coincident vertices of a model. Positions are binned into a spatial
+// hash with cells of twice the tolerance, so the neighbours of a vertex lie in
+// the 8 cells around it. Every vertex points to the smallest index within the
+// tolerance, chains are followed to their root and the roots are compacted.
+// All passes except two prefix sums run in parallel and the result does not
+// depend on the thread count.
+namespace mesh_weld{
+    using namespace geometry;
+
+    namespace detail{
+        inline uint64_t hashCell(int64_t x, int64_t y, int64_t z){
+            uint64_t h = static_cast<uint64_t>(x) * 0x9e3779b97f4a7c15ull;
+            h ^= static_cast<uint64_t>(y) * 0xc2b2ae3d27d4eb4full + (h << 6) + (h >> 2);
+            h ^= static_cast<uint64_t>(z) * 0x165667b19e3779f9ull + (h << 6) + (h >> 2);
+            return h ^ (h >> 29);
+        }
+    }
+
+    // tolerance is relative to the bounding box diagonal of the model, returns
+    // the number of vertices removed
+    inline size_t weldVertices(Model& model, float tolerance = 1e-6f){
+        if(!(tolerance > 0))
+            throw std::invalid_argument("weld tolerance must be positive");
+        auto& vertices = model.getVertices();
+        auto& packs = model.getIndexPacks();
+        size_t count = vertices.size();
+        if(count < 2)
+            return 0;
+        for(const auto& pack : packs){
+            if(pack.vertex >= count)
+                throw std::invalid_argument("face references a missing vertex");
+        }
+
+        BoundingBox<float> bounds = vertices.bounds();
+        double distance = tolerance * static_cast<double>(bounds.size().length());
+        // a model collapsed to one point still needs a cell size
+        double cell = distance > 0 ? 2 * distance : 1;
+        double distanceSquared = distance * distance;
+
+        size_t bucketCount = 1;
+        while(bucketCount < count)
+            bucketCount <<= 1;
+        uint64_t mask = bucketCount - 1;
+
+        auto cellOf = [&](const Vec3<float>& v, int axis){
+            return (static_cast<double>((&v.x)[axis]) - (&bounds.min.x)[axis]) / cell;
+        };
+
+        // counting sort of the vertices into buckets
+        std::vector<uint32_t> bucketOf(count);
+        std::vector<std::atomic<uint32_t>> offsets(bucketCount + 1);
+        for(auto& offset : offsets)
+            offset.store(0, std::memory_order_relaxed);
+        parallel::forRange(count, [&](size_t begin, size_t end){
+            for(size_t i = begin; i < end; ++i){
+                Vec3<float> v = vertices[i];
+                uint64_t h = detail::hashCell(static_cast<int64_t>(std::floor(cellOf(v, 0))),
+                                              static_cast<int64_t>(std::floor(cellOf(v, 1))),
+                                              static_cast<int64_t>(std::floor(cellOf(v, 2))));
+                bucketOf[i] = static_cast<uint32_t>(h & mask);
+                offsets[bucketOf[i] + 1].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+        for(size_t b = 0; b < bucketCount; ++b)
+            offsets[b + 1].fetch_add(offsets[b].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        std::vector<std::atomic<uint32_t>> fill(bucketCount);
+        for(size_t b = 0; b < bucketCount; ++b)
+            fill[b].store(offsets[b].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        std::vector<uint32_t> members(count);
+        parallel::forRange(count, [&](size_t begin, size_t end){
+            for(size_t i = begin; i < end; ++i)
+                members[fill[bucketOf[i]].fetch_add(1, std::memory_order_relaxed)] = static_cast<uint32_t>(i);
+        });
+
+        // smallest vertex within the tolerance, the order inside a bucket does not matter
+        std::vector<uint32_t> target(count);
+        parallel::forRange(count, [&](size_t begin, size_t end){
+            for(size_t i = begin; i < end; ++i){
+                Vec3<float> v = vertices[i];
+                int64_t base[3], step[3];
+                for(int a = 0; a < 3; ++a){
+                    double c = cellOf(v, a);
+                    double f = std::floor(c);
+                    base[a] = static_cast<int64_t>(f);
+                    step[a] = c - f < 0.5 ? -1 : 1;
+                }
+                uint32_t best = static_cast<uint32_t>(i);
+                for(int corner = 0; corner < 8; ++corner){
+                    uint64_t h = detail::hashCell(base[0] + (corner & 1 ? step[0] : 0),
+                                                  base[1] + (corner & 2 ? step[1] : 0),
+                                                  base[2] + (corner & 4 ? step[2] : 0));
+                    uint32_t bucket = static_cast<uint32_t>(h & mask);
+                    uint32_t last = offsets[bucket + 1].load(std::memory_order_relaxed);
+                    for(uint32_t m = offsets[bucket].load(std::memory_order_relaxed); m < last; ++m){
+                        uint32_t other = members[m];
+                        if(other >= best)
+                            continue;
+                        Vec3<float> d = vertices[other] - v;
+                        double squared = static_cast<double>(d.x) * d.x + static_cast<double>(d.y) * d.y + static_cast<double>(d.z) * d.z;
+                        if(squared <= distanceSquared)
+                            best = other;
+                    }
+                }
+                target[i] = best;
+            }
+        });
+
+        // targets only decrease, so every chain ends at a vertex pointing to itself
+        std::vector<uint32_t> root(count);
+        parallel::forRange(count, [&](size_t begin, size_t end){
+            for(size_t i = begin; i < end; ++i){
+                uint32_t r = static_cast<uint32_t>(i);
+                while(target[r] != r)
+                    r = target[r];
+                root[i] = r;
+            }
+        });
+
+        std::vector<uint32_t> remap(count);
+        size_t kept = 0;
+        for(size_t i = 0; i < count; ++i){
+            if(root[i] == i)
+                remap[i] = static_cast<uint32_t>(kept++);
+        }
+        if(kept == count)
+            return 0;
+        Vec3Array welded(kept);
+        parallel::forRange(count, [&](size_t begin, size_t end){
+            for(size_t i = begin; i < end; ++i){
+                if(root[i] == i)
+                    welded.set(remap[i], vertices[i]);
+            }
+        });
+        parallel::forRange(packs.size(), [&](size_t begin, size_t end){
+            for(size_t p = begin; p < end; ++p)
+                packs[p].vertex = remap[root[packs[p].vertex]];
+        });
+        vertices.swap(welded);
+        model.updateGeometry();
+        return count - kept;
+    }
+}//namespace mesh_weld
@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <exception>
+#include <mutex>
+
+namespace parallel{
+
+    inline unsigned int threadCount(){
+        unsigned int count = std::thread::hardware_concurrency();
+        return count == 0 ? 1 : count;
+    }
+
+    // calls f(begin, end) on contiguous blocks of [0, count), one block per thread
+    template<typename F>
+    void forRange(size_t count, F&& f, size_t minBlock = 4096, unsigned int threads = 0){
+        if(threads == 0)
+            threads = threadCount();
+        size_t blocks = std::max<size_t>(1, (count + minBlock - 1) / minBlock);
+        threads = static_cast<unsigned int>(std::min<size_t>(threads, blocks));
+        if(threads <= 1){
+            f(size_t(0), count);
+            return;
+        }
+        size_t block = (count + threads - 1) / threads;
+        // the first exception is kept and rethrown once every worker has joined
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        auto run = [&f, &error, &errorMutex](size_t begin, size_t end){
+            try{
+                f(begin, end);
+            }catch(...){
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if(!error)
+                    error = std::current_exception();
+            }
+        };
+        std::vector<std::thread> workers;
+        try{
+            for(unsigned int t = 1; t < threads; ++t){
+                size_t begin = std::min(count, t * block);
+                size_t end = std::min(count, begin + block);
+                if(begin < end)
+                    workers.emplace_back(run, begin, end);
+            }
+        }catch(...){
+            std::lock_guard<std::mutex> lock(errorMutex);
+            error = std::current_exception();
+        }
+        if(!error)
+            run(size_t(0), std::min(count, block));
+        for(auto& worker : workers)
+            worker.join();
+        if(error)
+            std::rethrow_exception(error);
+    }
+}//namespace parallel
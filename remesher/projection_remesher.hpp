@@ -1,127 +1,263 @@
 #pragma once
 #include <vector>
-#include <set>
+#include <string>
+#include <memory>
+#include <atomic>
 #include <cmath>
 #include <stdexcept>
 #include <functional>
 #include "../Model.h"
 #include "../Geometry.h"
+#include "../Vec3Array.h"
 #include "../Math.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_normals.hpp"
+#include "bvh.hpp"
+#include "chunked_scene.hpp"
+#include "bvh_cache.hpp"
+#include "parallel.hpp"
+#include "distance_field.hpp"
 #include <limits>
 
 //TODO::MEGA REFACTOR
 namespace projection_remesher{
     using namespace geometry;
 
-    struct Triangle{
-        Vec3<float> vertex;
-        Vec3<float> uVec;
-        Vec3<float> vVec;
-        float centerDist;
+    enum class Projection{
+        // along the ray toward the scene center, misses end up at the center
+        TowardCenter,
+        // to the nearest surface point through a distance field of the scene
+        ClosestPoint
+    };
 
-        Triangle(const Vec3<float> &vert, const Vec3<float> &u, const Vec3<float> &v, const Vec3<float> &c)
-            : vertex(vert),
-              uVec(u),
-              vVec(v),
-              centerDist((v-c).length()){}
+    struct RemeshOptions{
+        Projection projection = Projection::TowardCenter;
+        // resolution of the distance field used by Projection::ClosestPoint
+        distance_field::Options field;
+        // smooth normals of the projected surface instead of the primitive's
+        bool recomputeNormals = true;
+        // reorder triangles and vertices of the result for cache and fetch locality
+        bool optimizeOutput = false;
+        // directory of persisted scene hierarchies, empty to always build in memory
+        std::string cacheDirectory;
+    };
 
-        bool operator<(const Triangle& rhs) const {
-            return centerDist > rhs.centerDist;
-        }
+    struct RemeshStats{
+        float acmrBefore = 0;
+        float acmrAfter = 0;
+        // the scene hierarchy was mapped from the cache directory
+        bool cacheHit = false;
+        // vertices the ray missed, or that the field could not place and took
+        // an exact closest point query for
+        size_t fallbackVertices = 0;
     };
 
-    Vec3<float> sceneAvgCenter(const std::vector<Model>& scene){
-        unsigned count = 0;
-        Vec3<float> res = {0,0,0};
+    inline Vec3<float> sceneAvgCenter(const std::vector<Model>& scene){
+        size_t count = 0;
+        Vec3<double> res = {0,0,0};
         for(const auto& m : scene){
-            res += sumVectors(m.getVertices());
+            res += m.getWorldVertexSum();
             count += m.getVertices().size();
         }
-        return res /= count;
+        return {static_cast<float>(res.x / count), static_cast<float>(res.y / count), static_cast<float>(res.z / count)};
     }
 
-    Vec3<float> sceneBBCenter(const std::vector<Model>& scene){
-        Vec3<float> maxCoord = -Vec3<float>::max_vector();
-        Vec3<float> minCoord = Vec3<float>::max_vector();
+    inline Vec3<float> sceneBBCenter(const std::vector<Model>& scene){
+        BoundingBox<float> bounds;
         for(const auto& m : scene){
-            for(const auto & v: m.getVertices()){
-                if(v.x > maxCoord.x){
-                    maxCoord.x = v.x;
-                }
-                if(v.y > maxCoord.y){
-                    maxCoord.y = v.y;
-                }
-                if(v.z > maxCoord.z){
-                    maxCoord.z = v.z;
-                }
-
-                if(v.x < minCoord.x){
-                    minCoord.x = v.x;
-                }
-                if(v.y < minCoord.y){
-                    minCoord.y = v.y;
-                }
-                if(v.z < minCoord.z){
-                    minCoord.z = v.z;
-                }
-            }
+            bounds.extend(m.getWorldBounds());
         }
-        return (minCoord + maxCoord)/2;
+        return (bounds.min + bounds.max)/2;
     }
 
-    float sceneRadius(const Vec3<float> center, const std::vector<Model>& scene){
+    inline float sceneRadius(const Vec3<float> center, const std::vector<Model>& scene){
         float max = 0;
         for(const auto& m : scene){
-            float currDist = getRadius(center, m.getVertices());
-            if(currDist > max){
-                max = currDist;
-            }
+            max = std::max(max, m.getWorldMaxDistanceSquared(center));
         }
-        return max;
+        return std::sqrt(max);
+    }
+
+    inline void appendTriangles(const Model& m, std::vector<bvh::Triangle>& triangles){
+        const std::vector<IndexPack>& iPacks = m.getIndexPacks();
+        triangles.reserve(triangles.size() + iPacks.size() / 3);
+        // corners of transformed models are mapped one by one, without a copy of the positions
+        bool identity = m.getMatrix().isIdentity();
+        auto corner = [&](size_t i){
+            return identity ? m.getVertices().at(iPacks[i].vertex) : m.getWorldVertex(iPacks[i].vertex);
+        };
+        for(size_t i = 2; i < iPacks.size(); i += 3)
+            triangles.push_back({corner(i - 2), corner(i - 1), corner(i)});
     }
 
-    std::multiset<Triangle> getTriangles(const std::vector<Model>& scene, const Vec3<float>& center){
-        std::multiset<Triangle> triangles;
+    inline std::vector<bvh::Triangle> getTriangles(const std::vector<Model>& scene){
+        std::vector<bvh::Triangle> triangles;
         for(const auto & m : scene){
-            std::vector<IndexPack> iPacks = m.getIndexPacks();
-            for(size_t i = 2; i < iPacks.size(); i += 3){
-                auto mainVert = m.getVertex(iPacks[i-2].vertex);
-                auto uVec = m.getVertex(iPacks[i].vertex) - mainVert;
-                auto vVec = m.getVertex(iPacks[i - 1].vertex) - mainVert;
-                triangles.insert({mainVert, uVec, vVec, center});
-            }
+            appendTriangles(m, triangles);
         }
         return triangles;
     }
 
-    Model remesh(std::vector<Model>& scene, const Model& primitive){
-
-        Vec3<float> center = sceneBBCenter(scene);
-        Vec3<float> prim_center = getCentroid(primitive.getVertices());
+    inline Model fitToSphere(const Model& primitive, const Vec3<float>& center, float radius){
         Model result = primitive;
-        float sceneR = sceneRadius(center, scene);
+        result.bakeTransform();
+        Vec3<float> prim_center = getCentroid(result.getVertices());
         float resultR = getRadius(result.getVertices());
-        result.uniformScale(2*sceneR/resultR);
+        result.uniformScale(2*radius/resultR);
         result.translate(center - prim_center);
-        
-        std::multiset<Triangle> triangles = getTriangles(scene, center);
-
-        for(auto& v : result.getVertices()){
-            Vec3<float> moveDir = center - v;
-            bool moved = false;
-            for(const auto& t : triangles){
-                float parameter = math::getFirstParameter(moveDir, -1*t.uVec, -1*t.vVec, t.vertex - v);
-                if(parameter >= 0 && parameter <= 1){
-                    v += parameter*moveDir;
-                    moved = true;
-                    break;
-                }
+        result.bakeTransform();
+        return result;
+    }
+
+    inline Model fitToScene(const std::vector<Model>& scene, const Model& primitive, const Vec3<float>& center){
+        return fitToSphere(primitive, center, sceneRadius(center, scene));
+    }
+
+    // moves v toward center onto the first scene surface it meets, Scene is
+    // anything with intersect(origin, direction, t) such as bvh::BvhView
+    template<typename Scene>
+    bool projectVertex(Vec3<float>& v, const Vec3<float>& center, const Scene& scene){
+        Vec3<float> moveDir = center - v;
+        float parameter = 1;
+        if(!scene.intersect(v, moveDir, parameter))
+            return false;
+        v += parameter*moveDir;
+        return true;
+    }
+
+    inline void finishModel(Model& result, const RemeshOptions& options, RemeshStats* stats){
+        if(options.recomputeNormals){
+            mesh_normals::recomputeNormals(result);
+        }
+        if(options.optimizeOutput){
+            mesh_optimizer::Report report = mesh_optimizer::optimizeModel(result);
+            if(stats){
+                stats->acmrBefore = report.acmrBefore;
+                stats->acmrAfter = report.acmrAfter;
             }
-            if(!moved){
+        }
+    }
+
+    template<typename Scene>
+    void projectModel(Model& result, const Vec3<float>& center, const Scene& scene,
+                      const RemeshOptions& options, RemeshStats* stats){
+        size_t missed = 0;
+        auto& vertices = result.getVertices();
+        for(size_t i = 0; i < vertices.size(); ++i){
+            Vec3<float> v = vertices[i];
+            if(!projectVertex(v, center, scene)){
                 v = center;
+                missed++;
+            }
+            vertices.set(i, v);
+        }
+        if(stats){
+            stats->fallbackVertices = missed;
+        }
+        finishModel(result, options, stats);
+    }
+
+    // the field is read only, so vertices are projected in parallel, threads 0 for one per core
+    inline void projectModel(Model& result, const distance_field::DistanceField& field, const bvh::BvhView& scene,
+                             const RemeshOptions& options, RemeshStats* stats, unsigned int threads = 0){
+        auto& vertices = result.getVertices();
+        std::atomic<size_t> fallbacks{0};
+        parallel::forRange(vertices.size(), [&](size_t begin, size_t end){
+            size_t local = 0;
+            for(size_t i = begin; i < end; ++i){
+                Vec3<float> v = vertices[i];
+                if(!field.project(v, scene))
+                    local++;
+                vertices.set(i, v);
             }
+            fallbacks += local;
+        }, 1024, threads);
+        if(stats){
+            stats->fallbackVertices = fallbacks;
+        }
+        finishModel(result, options, stats);
+    }
+
+    // scene data shared by any number of projections
+    struct PreparedScene{
+        Vec3<float> center;
+        float radius = 0;
+        bvh_cache::CachedBvh triangles;
+        // only built for Projection::ClosestPoint
+        std::shared_ptr<const distance_field::DistanceField> field;
+    };
+
+    inline PreparedScene prepareScene(const std::vector<Model>& scene,
+                                      const RemeshOptions& options = {}, RemeshStats* stats = nullptr){
+        PreparedScene result;
+        result.center = sceneBBCenter(scene);
+        result.radius = sceneRadius(result.center, scene);
+        if(options.cacheDirectory.empty()){
+            result.triangles = bvh_cache::CachedBvh(bvh::Bvh(getTriangles(scene)));
+        }else{
+            result.triangles = bvh_cache::CachedBvh::load(getTriangles(scene), result.center, options.cacheDirectory);
+        }
+        if(stats){
+            stats->cacheHit = result.triangles.isMapped();
+        }
+        if(options.projection == Projection::ClosestPoint){
+            // fitted primitives start on a sphere of twice the scene radius
+            result.field = std::make_shared<const distance_field::DistanceField>(
+                result.triangles.view(), result.center, 2 * result.radius, options.field);
         }
         return result;
+    }
+
+    inline void checkPrepared(const PreparedScene& scene, const RemeshOptions& options){
+        if(options.projection == Projection::ClosestPoint && !scene.field)
+            throw std::invalid_argument("scene was prepared without a distance field");
+    }
 
+    // the prepared scene is only read, so several projections may run at once,
+    // threads is used by the closest point pass, 0 for one per core
+    inline Model project(const PreparedScene& scene, const Model& primitive,
+                         const RemeshOptions& options = {}, RemeshStats* stats = nullptr,
+                         unsigned int threads = 0){
+        checkPrepared(scene, options);
+        Model result = fitToSphere(primitive, scene.center, scene.radius);
+        if(options.projection == Projection::ClosestPoint){
+            projectModel(result, *scene.field, scene.triangles.view(), options, stats, threads);
+            return result;
+        }
+        projectModel(result, scene.center, scene.triangles.view(), options, stats);
+        return result;
+    }
+
+    // threads is the number of primitives projected at once, 0 for one per core
+    inline std::vector<Model> project(const PreparedScene& scene, const std::vector<Model>& primitives,
+                                      const RemeshOptions& options = {}, unsigned int threads = 1,
+                                      std::vector<RemeshStats>* stats = nullptr){
+        checkPrepared(scene, options);
+        std::vector<Model> results(primitives);
+        if(stats){
+            stats->assign(primitives.size(), RemeshStats());
+        }
+        // primitives projected side by side keep their vertex pass on one thread
+        unsigned int vertexThreads = threads == 1 ? 0 : 1;
+        parallel::forRange(primitives.size(), [&](size_t begin, size_t end){
+            for(size_t i = begin; i < end; ++i){
+                results[i] = project(scene, primitives[i], options, stats ? &(*stats)[i] : nullptr, vertexThreads);
+            }
+        }, 1, threads);
+        return results;
+    }
+
+    inline Model remesh(std::vector<Model>& scene, const Model& primitive,
+                        const RemeshOptions& options = {}, RemeshStats* stats = nullptr){
+        return project(prepareScene(scene, options, stats), primitive, options, stats);
+    }
+
+    // out-of-core variant, only the chunks the projection passes through are
+    // mapped; it always projects toward the center
+    inline Model remesh(const chunked_scene::ChunkedScene& scene, const Model& primitive,
+                        const RemeshOptions& options = {}, RemeshStats* stats = nullptr){
+        Model result = fitToSphere(primitive, scene.getCenter(), scene.getRadius());
+        projectModel(result, scene.getCenter(), scene, options, stats);
+        return result;
     }
 }//namespace sewer
\ No newline at end of file
@@ -0,0 +1,229 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include <stdexcept>
+#include "../Geometry.h"
+#include "../Vec3Array.h"
+#include "../Model.h"
+#include "bvh.hpp"
+#include "parallel.hpp"
+#include "projection_remesher.hpp"
+#include "mesh_normals.hpp"
+
+// Remeshing that follows edits of single scene models. Every model keeps its
+// own hierarchy and every primitive vertex remembers which model its ray hit.
+// When a model changes only its hierarchy is rebuilt, and only the rays that
+// cross its old or new bounds are traced again; the rest keep their result.
+// The projection sphere is fixed when the session starts, so edits never move
+// the primitive itself, and only normals around moved vertices are recomputed.
+namespace remesh_session{
+    using namespace geometry;
+
+    struct UpdateStats{
+        // rays crossing the old or new bounds of the changed model
+        size_t retracedVertices = 0;
+        // vertices whose projected position changed
+        size_t movedVertices = 0;
+    };
+
+    class Session{
+    public:
+        Session(const std::vector<Model>& scene, const Model& primitive,
+                const projection_remesher::RemeshOptions& options = {})
+            : _options(options)
+            , _center(projection_remesher::sceneBBCenter(scene))
+            , _result(projection_remesher::fitToSphere(primitive, _center, projection_remesher::sceneRadius(_center, scene))){
+            if(options.projection != projection_remesher::Projection::TowardCenter)
+                throw std::invalid_argument("remesh sessions only project toward the center");
+            // reordering would break the link between vertices and their rays
+            if(options.optimizeOutput)
+                throw std::invalid_argument("remesh sessions cannot optimize their result");
+            _models.reserve(scene.size());
+            for(const auto& model : scene)
+                _models.push_back(bvh::Bvh(trianglesOf(model)));
+            _starts = _result.getVertices();
+            _hits.assign(_starts.size(), noModel);
+            _parameters.assign(_starts.size(), 1);
+
+            std::vector<char> all(_starts.size(), 1);
+            std::vector<unsigned int> moved;
+            retrace(all, nullptr, moved);
+            if(_options.recomputeNormals){
+                std::vector<unsigned int> corners;
+                if(!_result.getIndices().empty()){
+                    corners = _result.getIndices();
+                }else{
+                    for(auto& pack : _result.getIndexPacks()){
+                        corners.push_back(pack.vertex);
+                        pack.normal = pack.vertex;
+                    }
+                }
+                _normals.reset(new mesh_normals::NormalUpdater(_result.getVertices(), std::move(corners)));
+                _result.getNormals() = _normals->compute(_result.getVertices());
+                _result.updateGeometry();
+            }
+        }
+
+        const Model& getResult() const { return _result; }
+        size_t getModelCount() const { return _models.size(); }
+
+        // model may have any transform, its world space triangles replace the old ones
+        UpdateStats updateModel(size_t index, const Model& model){
+            if(index >= _models.size())
+                throw std::out_of_range("no model at this index");
+            return replace(index, bvh::Bvh(trianglesOf(model)));
+        }
+
+        // vertices that are not where tracing every ray against all current
+        // models puts them, zero unless incremental updates went wrong
+        size_t countMismatches() const{
+            std::atomic<size_t> mismatches{0};
+            parallel::forRange(_starts.size(), [&](size_t begin, size_t end){
+                size_t local = 0;
+                for(size_t i = begin; i < end; ++i){
+                    Vec3<float> direction = _center - _starts[i];
+                    float parameter = 1;
+                    bool hit = false;
+                    for(const auto& model : _models){
+                        float t = parameter;
+                        if(model.view().intersect(_starts[i], direction, t) && t < parameter){
+                            parameter = t;
+                            hit = true;
+                        }
+                    }
+                    Vec3<float> expected = hit ? _starts[i] + parameter * direction : _center;
+                    Vec3<float> actual = _result.getVertices()[i];
+                    if(expected.x != actual.x || expected.y != actual.y || expected.z != actual.z)
+                        local++;
+                }
+                mismatches += local;
+            }, 1024);
+            return mismatches;
+        }
+
+        // returns the index later updates refer to
+        size_t addModel(const Model& model, UpdateStats* stats = nullptr){
+            _models.emplace_back();
+            UpdateStats result = replace(_models.size() - 1, bvh::Bvh(trianglesOf(model)));
+            if(stats)
+                *stats = result;
+            return _models.size() - 1;
+        }
+
+        // the slot stays empty, so other indices do not shift
+        UpdateStats removeModel(size_t index){
+            if(index >= _models.size())
+                throw std::out_of_range("no model at this index");
+            return replace(index, bvh::Bvh());
+        }
+
+    private:
+        static constexpr uint32_t noModel = std::numeric_limits<uint32_t>::max();
+
+        static std::vector<bvh::Triangle> trianglesOf(const Model& model){
+            std::vector<bvh::Triangle> triangles;
+            projection_remesher::appendTriangles(model, triangles);
+            return triangles;
+        }
+
+        UpdateStats replace(size_t index, bvh::Bvh model){
+            bvh::BvhView old = _models[index].view();
+            BoundingBox<float> oldBounds = old.isEmpty() ? BoundingBox<float>() : old.bounds();
+            _models[index] = std::move(model);
+            bvh::BvhView current = _models[index].view();
+            BoundingBox<float> newBounds = current.isEmpty() ? BoundingBox<float>() : current.bounds();
+
+            // the changed triangles lie inside these boxes, no other ray can meet them
+            std::vector<char> affected(_starts.size(), 0);
+            std::atomic<size_t> retraced{0};
+            parallel::forRange(_starts.size(), [&](size_t begin, size_t end){
+                size_t local = 0;
+                for(size_t i = begin; i < end; ++i){
+                    Vec3<float> direction = _center - _starts[i];
+                    Vec3<float> inverse = {1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z};
+                    float entry;
+                    if((!oldBounds.isEmpty() && bvh::intersectsBox(oldBounds, _starts[i], inverse, 1, entry))
+                       || (!newBounds.isEmpty() && bvh::intersectsBox(newBounds, _starts[i], inverse, 1, entry))){
+                        affected[i] = 1;
+                        local++;
+                    }
+                }
+                retraced += local;
+            });
+
+            UpdateStats stats;
+            stats.retracedVertices = retraced;
+            if(stats.retracedVertices == 0)
+                return stats;
+            std::vector<unsigned int> moved;
+            stats.movedVertices = retrace(affected, &index, moved);
+            if(stats.movedVertices > 0){
+                if(_normals)
+                    _normals->update(_result.getVertices(), moved, _result.getNormals());
+                _result.updateGeometry();
+            }
+            return stats;
+        }
+
+        // traces the marked rays, a ray that did not hit the changed model
+        // before only has to be tested against it; returns the number of moved
+        // vertices and lists them in moved
+        size_t retrace(const std::vector<char>& marked, const size_t* changed, std::vector<unsigned int>& moved){
+            auto& vertices = _result.getVertices();
+            std::vector<char> changedVertex(_starts.size(), 0);
+            parallel::forRange(_starts.size(), [&](size_t begin, size_t end){
+                for(size_t i = begin; i < end; ++i){
+                    if(!marked[i])
+                        continue;
+                    Vec3<float> direction = _center - _starts[i];
+                    uint32_t hit = _hits[i];
+                    float parameter = _parameters[i];
+                    if(changed && hit != *changed){
+                        float t = parameter;
+                        if(_models[*changed].view().intersect(_starts[i], direction, t) && t < parameter){
+                            hit = static_cast<uint32_t>(*changed);
+                            parameter = t;
+                        }
+                    }else{
+                        hit = noModel;
+                        parameter = 1;
+                        for(size_t m = 0; m < _models.size(); ++m){
+                            float t = parameter;
+                            if(_models[m].view().intersect(_starts[i], direction, t) && t < parameter){
+                                hit = static_cast<uint32_t>(m);
+                                parameter = t;
+                            }
+                        }
+                    }
+                    // rays that miss everything end in the center, as in projectModel
+                    Vec3<float> position = hit == noModel ? _center : _starts[i] + parameter * direction;
+                    _hits[i] = hit;
+                    _parameters[i] = parameter;
+                    if(position.x != vertices[i].x || position.y != vertices[i].y || position.z != vertices[i].z){
+                        vertices.set(i, position);
+                        changedVertex[i] = 1;
+                    }
+                }
+            }, 1024);
+            moved.clear();
+            for(size_t i = 0; i < changedVertex.size(); ++i){
+                if(changedVertex[i])
+                    moved.push_back(static_cast<unsigned int>(i));
+            }
+            return moved.size();
+        }
+
+        projection_remesher::RemeshOptions _options;
+        Vec3<float> _center;
+        Model _result;
+        std::vector<bvh::Bvh> _models;
+        // fitted primitive positions, the ray of vertex i runs from _starts[i] to _center
+        Vec3Array _starts;
+        std::vector<uint32_t> _hits;
+        std::vector<float> _parameters;
+        // empty unless the options recompute normals
+        std::unique_ptr<mesh_normals::NormalUpdater> _normals;
+    };
+}//namespace remesh_session
@@ -0,0 +1,180 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Memory mapped files, so large on-disk structures are paged in by the OS on
+// demand instead of being read into memory, and shared memory objects for
+// handing results to other processes.
+namespace storage{
+
+    class MappedFile{
+    public:
+        MappedFile() = default;
+        explicit MappedFile(const std::string& path, bool writable = false){
+            int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+            if(fd < 0)
+                throw std::invalid_argument("cannot open " + path);
+            struct stat info;
+            if(::fstat(fd, &info) != 0){
+                ::close(fd);
+                throw std::invalid_argument("cannot stat " + path);
+            }
+            _size = static_cast<size_t>(info.st_size);
+            if(_size > 0){
+                int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+                void* data = ::mmap(nullptr, _size, protection, MAP_SHARED, fd, 0);
+                if(data == MAP_FAILED){
+                    ::close(fd);
+                    throw std::runtime_error("cannot map " + path);
+                }
+                _data = data;
+            }
+            // the mapping stays valid after the descriptor is closed
+            ::close(fd);
+        }
+        ~MappedFile(){ unmap(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept { swap(other); }
+        MappedFile& operator=(MappedFile&& other) noexcept{
+            if(this != &other){
+                unmap();
+                swap(other);
+            }
+            return *this;
+        }
+
+        const void* data() const { return _data; }
+        // only for files mapped writable
+        void* data() { return _data; }
+        size_t size() const { return _size; }
+        bool isMapped() const { return _data != nullptr; }
+        // writes changes of a writable mapping back to the file
+        void flush(){
+            if(_data && ::msync(_data, _size, MS_SYNC) != 0)
+                throw std::runtime_error("cannot flush mapped file");
+        }
+
+        void swap(MappedFile& other) noexcept{
+            std::swap(_data, other._data);
+            std::swap(_size, other._size);
+        }
+
+    private:
+        void unmap(){
+            if(_data)
+                ::munmap(_data, _size);
+            _data = nullptr;
+            _size = 0;
+        }
+
+        void* _data = nullptr;
+        size_t _size = 0;
+    };
+
+    // creates or truncates a zero filled file of size bytes
+    inline void createFile(const std::string& path, size_t size){
+        int fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+        if(fd < 0)
+            throw std::runtime_error("cannot create " + path);
+        bool resized = ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+        ::close(fd);
+        if(!resized)
+            throw std::runtime_error("cannot resize " + path);
+    }
+
+    // POSIX shared memory object created and owned by this process, other
+    // processes open it by name; the name is unlinked on destruction
+    class SharedMemory{
+    public:
+        SharedMemory() = default;
+        SharedMemory(const std::string& name, size_t size) : _name(name){
+            int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if(fd < 0)
+                throw std::runtime_error("cannot create shared memory " + name);
+            if(size > 0 && ::ftruncate(fd, static_cast<off_t>(size)) != 0){
+                ::close(fd);
+                ::shm_unlink(name.c_str());
+                throw std::runtime_error("cannot resize shared memory " + name);
+            }
+            _size = size;
+            if(_size > 0){
+                void* data = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if(data == MAP_FAILED){
+                    ::close(fd);
+                    ::shm_unlink(name.c_str());
+                    throw std::runtime_error("cannot map shared memory " + name);
+                }
+                _data = data;
+            }
+            ::close(fd);
+        }
+        ~SharedMemory(){ release(); }
+
+        SharedMemory(const SharedMemory&) = delete;
+        SharedMemory& operator=(const SharedMemory&) = delete;
+        SharedMemory(SharedMemory&& other) noexcept { swap(other); }
+        SharedMemory& operator=(SharedMemory&& other) noexcept{
+            if(this != &other){
+                release();
+                swap(other);
+            }
+            return *this;
+        }
+
+        void* data() { return _data; }
+        size_t size() const { return _size; }
+        const std::string& name() const { return _name; }
+
+        void swap(SharedMemory& other) noexcept{
+            std::swap(_name, other._name);
+            std::swap(_data, other._data);
+            std::swap(_size, other._size);
+        }
+
+    private:
+        void release(){
+            if(_data)
+                ::munmap(_data, _size);
+            if(!_name.empty())
+                ::shm_unlink(_name.c_str());
+            _name.clear();
+            _data = nullptr;
+            _size = 0;
+        }
+
+        std::string _name;
+        void* _data = nullptr;
+        size_t _size = 0;
+    };
+
+    inline bool hostIsBigEndian(){
+        const uint16_t probe = 1;
+        unsigned char first;
+        std::memcpy(&first, &probe, 1);
+        return first == 0;
+    }
+
+    // unaligned read of a value stored in the other byte order when swap is set
+    template<typename T>
+    T readRaw(const unsigned char* at, bool swap){
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, at, sizeof(T));
+        if(swap){
+            for(size_t i = 0; i < sizeof(T) / 2; ++i)
+                std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+        }
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+}//namespace storage
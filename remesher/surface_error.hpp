@@ -0,0 +1,180 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include "../Geometry.h"
+#include "../Vec3Array.h"
+#include "../Model.h"
+#include "bvh.hpp"
+#include "parallel.hpp"
+#include "projection_remesher.hpp"
+
+// Distance between a remeshed surface and its scene. Both surfaces are sampled
+// by area weighted random points, the remeshed one also by all its vertices,
+// and every sample looks up its closest point on the other surface in a
+// hierarchy. Scene vertices are left out, there can be millions of them.
+// Samples are drawn from a hash of their index, so the report does not depend
+// on the thread count, and neither do the sums of their distances.
+namespace surface_error{
+    using namespace geometry;
+
+    struct Options{
+        // random surface points on each side
+        size_t samples = 1 << 20;
+        uint64_t seed = 1;
+        // a result vertex farther from the scene than this fraction of the
+        // scene diagonal counts as off the surface
+        double onSurface = 1e-5;
+    };
+
+    struct Distances{
+        size_t samples = 0;
+        double max = 0;
+        double mean = 0;
+        double rms = 0;
+        // given vertices farther than the tolerance from the other surface
+        size_t offSurface = 0;
+    };
+
+    struct Report{
+        // from the remeshed surface to the scene
+        Distances forward;
+        // from the scene to the remeshed surface
+        Distances backward;
+        // symmetric Hausdorff distance
+        double hausdorff = 0;
+        // scene bounding box diagonal, to put the distances in scale
+        double diagonal = 0;
+        // vertices remesh placed at the center because their ray missed
+        size_t centerVertices = 0;
+    };
+
+    namespace detail{
+        inline uint64_t mix(uint64_t x){
+            x += 0x9e3779b97f4a7c15ull;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            return x ^ (x >> 31);
+        }
+
+        inline float unit(uint64_t bits){
+            return static_cast<float>(bits >> 40) / static_cast<float>(1 << 24);
+        }
+
+        // the given vertices, then area weighted points on the triangles of from
+        inline Distances measure(const Vec3Array& vertices, const bvh::BvhView& from,
+                                 const bvh::BvhView& to, const Options& options, uint64_t stream,
+                                 double tolerance = 0){
+            std::vector<double> area(from.triangleCount + 1, 0);
+            for(size_t t = 0; t < from.triangleCount; ++t){
+                const bvh::Triangle& tri = from.triangles[t];
+                area[t + 1] = area[t] + 0.5 * cross(tri.b - tri.a, tri.c - tri.a).length();
+            }
+            size_t fixed = vertices.size();
+            size_t random = area.back() > 0 ? options.samples : 0;
+            size_t total = fixed + random;
+
+            // fixed blocks whose partial sums are added in block order, so the
+            // floating point result does not depend on how threads split them
+            const size_t blockSize = 1024;
+            size_t blocks = (total + blockSize - 1) / blockSize;
+            std::vector<double> blockMax(blocks, 0), blockSum(blocks, 0), blockSquares(blocks, 0);
+            std::vector<size_t> blockOff(blocks, 0);
+            parallel::forRange(blocks, [&](size_t firstBlock, size_t lastBlock){
+                // consecutive samples lie close together, the previous closest
+                // triangle bounds the next search
+                uint32_t last = std::numeric_limits<uint32_t>::max();
+                for(size_t b = firstBlock; b < lastBlock; ++b){
+                    double localMax = 0, localSum = 0, localSquares = 0;
+                    size_t localOff = 0;
+                    for(size_t i = b * blockSize; i < std::min(total, (b + 1) * blockSize); ++i){
+                        Vec3<float> p;
+                        if(i < fixed){
+                            p = vertices[i];
+                        }else{
+                            // stratified, so samples follow the spatial order of the triangles
+                            uint64_t h = mix(options.seed ^ mix(stream + i));
+                            double target = (i - fixed + unit(h)) / random * area.back();
+                            size_t t = std::upper_bound(area.begin() + 1, area.end(), target) - area.begin() - 1;
+                            t = std::min(t, from.triangleCount - 1);
+                            float r1 = std::sqrt(unit(mix(h))), r2 = unit(mix(h + 1));
+                            const bvh::Triangle& tri = from.triangles[t];
+                            p = (1 - r1) * tri.a + (r1 * (1 - r2)) * tri.b + (r1 * r2) * tri.c;
+                        }
+                        float squared = std::numeric_limits<float>::max();
+                        Vec3<float> point;
+                        uint32_t triangle = last;
+                        if(last < to.triangleCount){
+                            point = bvh::closestPointOnTriangle(to.triangles[last], p);
+                            squared = (point - p).lengthSquared();
+                        }
+                        to.closestPoint(p, squared, point, triangle);
+                        last = triangle;
+                        double d = std::sqrt(static_cast<double>(squared));
+                        localMax = std::max(localMax, d);
+                        localSum += d;
+                        localSquares += d * d;
+                        if(i < fixed && d > tolerance)
+                            localOff++;
+                    }
+                    blockMax[b] = localMax;
+                    blockSum[b] = localSum;
+                    blockSquares[b] = localSquares;
+                    blockOff[b] = localOff;
+                }
+            }, 1);
+            Distances result;
+            double sum = 0, sumSquares = 0;
+            for(size_t b = 0; b < blocks; ++b){
+                result.max = std::max(result.max, blockMax[b]);
+                sum += blockSum[b];
+                sumSquares += blockSquares[b];
+                result.offSurface += blockOff[b];
+            }
+            result.samples = total;
+            if(total > 0){
+                result.mean = sum / total;
+                result.rms = std::sqrt(sumSquares / total);
+            }
+            return result;
+        }
+    }
+
+    // scene is the hierarchy the result was projected onto, e.g. PreparedScene::triangles
+    inline Report evaluate(const bvh::BvhView& scene, const Model& result, const Vec3<float>& center,
+                           const Options& options = {}){
+        Report report;
+        if(scene.isEmpty())
+            return report;
+        Model world = result;
+        world.bakeTransform();
+        std::vector<bvh::Triangle> triangles;
+        projection_remesher::appendTriangles(world, triangles);
+        bvh::Bvh remeshed(std::move(triangles));
+        if(remeshed.view().isEmpty())
+            return report;
+        report.diagonal = scene.bounds().size().length();
+        report.forward = detail::measure(world.getVertices(), remeshed.view(), scene, options, 0,
+                                         options.onSurface * report.diagonal);
+        report.backward = detail::measure({}, scene, remeshed.view(), options, 1ull << 62);
+        report.hausdorff = std::max(report.forward.max, report.backward.max);
+        const Vec3Array& vertices = world.getVertices();
+        for(size_t i = 0; i < vertices.size(); ++i){
+            if(vertices.x()[i] == center.x && vertices.y()[i] == center.y && vertices.z()[i] == center.z)
+                report.centerVertices++;
+        }
+        return report;
+    }
+
+    inline Report evaluate(const projection_remesher::PreparedScene& scene, const Model& result,
+                           const Options& options = {}){
+        return evaluate(scene.triangles.view(), result, scene.center, options);
+    }
+
+    inline Report evaluate(const std::vector<Model>& scene, const Model& result, const Options& options = {}){
+        bvh::Bvh triangles(projection_remesher::getTriangles(scene));
+        return evaluate(triangles.view(), result, projection_remesher::sceneBBCenter(scene), options);
+    }
+}//namespace surface_error
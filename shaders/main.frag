@@ -2,8 +2,8 @@
 
 in vec3 normal_;
 in vec3 texture_;
+in vec3 color_;
 uniform sampler2D sample;
-uniform vec3 color;
 uniform vec3 light_position;
 
 out vec4 final_color;
@@ -14,5 +14,5 @@ void main() {
     vec3 N = normalize(normal_);
     //float Idiff = max(dot(L, N), 0.0);
     float Idiff = abs(dot(L, N));
-    final_color = vec4(color + Idiff*vec3(0.2f,0.2f,0.2f) ,1.0f);
+    final_color = vec4(color_ + Idiff*vec3(0.2f,0.2f,0.2f) ,1.0f);
 }
\ No newline at end of file
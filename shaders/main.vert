@@ -3,13 +3,34 @@
 in vec3 position;
 in vec3 normal;
 in vec3 texture;
+in float object;
 
 out vec3 normal_;
 out vec3 texture_;
+out vec3 color_;
 uniform mat4 MVPmatrix;
+uniform mat4 modelMatrix;
+uniform mat3 normalMatrix;
+uniform vec3 color;
+uniform bool batched;
+uniform sampler2D objectData;
+
+vec4 objectTexel(int texel) {
+    int width = textureSize(objectData, 0).x;
+    return texelFetch(objectData, ivec2(texel % width, texel / width), 0);
+}
 
 void main() {
-    gl_Position = MVPmatrix * vec4(position, 1.0);
-    normal_ = normal;
+    mat4 model = modelMatrix;
+    mat3 normalModel = normalMatrix;
+    color_ = color;
+    if (batched) {
+        int base = int(object + 0.5) * 5;
+        model = mat4(objectTexel(base), objectTexel(base + 1), objectTexel(base + 2), objectTexel(base + 3));
+        normalModel = mat3(model);
+        color_ = objectTexel(base + 4).rgb;
+    }
+    gl_Position = MVPmatrix * model * vec4(position, 1.0);
+    normal_ = normalModel * normal;
     texture_ = texture;
-}
\ No newline at end of file
+}